@@ -0,0 +1,15 @@
+#version 330 core
+
+in vec4 fragColor;
+
+out vec4 color;
+
+void main()
+{
+    // round, antialiased points
+    float r = length(gl_PointCoord*2.0 - 1.0);
+    float alpha = fragColor.a * clamp((1.0 - r)/max(fwidth(r), 1e-4), 0.0, 1.0);
+    if(alpha < 1.0/255.0)
+        discard;
+    color = vec4(fragColor.rgb, alpha);
+}
@@ -0,0 +1,34 @@
+#version 330 core
+
+layout (location = 0) in vec4 state0;   // position xy, velocity zw
+layout (location = 1) in vec4 state1;   // age, lifetime, kind, unused
+
+uniform mat4 VP;
+uniform float point_scale;              // pixels per world unit
+
+out vec4 fragColor;
+
+void main ()
+{
+    // dead particles are pushed outside the clip volume
+    if(state1.x >= state1.y)
+    {
+        fragColor = vec4(0.0);
+        gl_PointSize = 1.0;
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    float t = state1.x / state1.y;
+    vec3 color;
+    if(state1.z < 0.5)
+        color = vec3(0.8, 0.498039, 0.196078);          // coin pickup, coin color
+    else if(state1.z < 1.5)
+        color = vec3(0.847059, 0.847059, 0.74902);      // bounce dust
+    else
+        color = vec3(0.59, 0.41, 0.31);                 // trap death, trappy box color
+    fragColor = vec4(color, 1.0 - t);
+
+    gl_PointSize = max(1.0, point_scale * 0.05 * (1.0 - 0.5*t));
+    gl_Position = VP * vec4(state0.xy, 0.0, 1.0);
+}
@@ -0,0 +1,66 @@
+#version 330 core
+
+// Particle state, ping-ponged between two buffers through transform feedback
+layout (location = 0) in vec4 state0;   // position xy, velocity zw
+layout (location = 1) in vec4 state1;   // age, lifetime, kind, unused
+
+#define MAX_SPAWNS 16
+
+// spawn records written by the CPU this frame, each one owns a range of the particle ring
+uniform int spawn_count;
+uniform vec4 spawn_origin[MAX_SPAWNS];  // position xy, speed, kind
+uniform ivec2 spawn_range[MAX_SPAWNS];  // first particle, count (wraps around capacity)
+uniform int capacity;
+uniform uint seed;
+uniform float dt;
+uniform float ground_y;
+
+out vec4 out_state0;
+out vec4 out_state1;
+
+float random (uint x)
+{
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return float(x) / 4294967295.0;
+}
+
+void main ()
+{
+    for(int s=0; s<spawn_count; s++)
+    {
+        int offset = gl_VertexID - spawn_range[s].x;
+        if(offset < 0)
+            offset += capacity;
+        if(offset < spawn_range[s].y)
+        {
+            uint key = uint(gl_VertexID) * 3u + seed * 0x9e3779b9u;
+            float angle = random(key) * 6.2831853;
+            float speed = spawn_origin[s].z * (0.2 + 0.8*random(key + 1u));
+            out_state0 = vec4(spawn_origin[s].xy, speed*cos(angle), speed*sin(angle));
+            out_state1 = vec4(0.0, 0.4 + 0.8*random(key + 2u), spawn_origin[s].w, 0.0);
+            return;
+        }
+    }
+
+    // dead particles stay dead until a spawn claims their slot
+    if(state1.x >= state1.y)
+    {
+        out_state0 = state0;
+        out_state1 = state1;
+        return;
+    }
+
+    vec2 velocity = state0.zw;
+    velocity.y -= 5.0*dt;
+    velocity *= 1.0 - 1.5*dt;
+    vec2 position = state0.xy + velocity*dt;
+    if(position.y < ground_y && velocity.y < 0.0)
+    {
+        position.y = ground_y;
+        velocity *= vec2(0.7, -0.4);
+    }
+    out_state0 = vec4(position, velocity);
+    out_state1 = vec4(state1.x + dt, state1.yzw);
+}
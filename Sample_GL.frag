@@ -2,13 +2,40 @@
 
 // Interpolated values from the vertex shaders
 in vec3 fragColor;
+// Circles are drawn as one quad: xy is the position in radii from the centre,
+// z the kind (0 plain fill, 1 disc, 2 outline) and w the spokes inside an outline
+in vec4 fragShape;
 
 // output data
-out vec3 color;
+out vec4 color;
 
 void main()
 {
     // Output color = color specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
-    color = fragColor;
+    if(fragShape.z < 0.5) {
+        color = vec4(fragColor, 1.0);
+        return;
+    }
+
+    // signed distance to the circle in radii, fwidth turns it into pixels so the
+    // edge stays one pixel soft at any zoom
+    float r = length(fragShape.xy);
+    float pixel = max(fwidth(r), 1e-4);
+    float coverage;
+    if(fragShape.z < 1.5)
+        coverage = clamp((1.0 - r)/pixel + 0.5, 0.0, 1.0);
+    else {
+        // one pixel wide outline plus the spokes of the old wireframe fans
+        coverage = clamp(1.0 - abs(r - 1.0)/pixel, 0.0, 1.0);
+        if(fragShape.w > 0.5) {
+            float spoke = 6.2831853/fragShape.w;
+            float a = atan(fragShape.y, fragShape.x);
+            float d = r*abs(sin(a - spoke*floor(a/spoke + 0.5)));
+            coverage = max(coverage, clamp(1.0 - d/pixel, 0.0, 1.0) * clamp((1.0 - r)/pixel + 0.5, 0.0, 1.0));
+        }
+    }
+    if(coverage < 1.0/255.0)
+        discard;
+    color = vec4(fragColor, coverage);
 }
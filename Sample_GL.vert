@@ -3,19 +3,35 @@
 // input data : sent from main program
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
+layout (location = 2) in vec4 vertexShape; // circles only, see Sample_GL.frag
 
 uniform mat4 MVP;
 
+// procedural motion evaluated per vertex, the game evaluates the same formula for anything
+// that takes part in the physics (see Animation in Sample_GL3_2D.cpp)
+uniform float time;     // seconds on the frame clock
+uniform vec2 spin;      // turn about the model origin: rate in rad/s, phase in rad
+uniform vec4 path;      // xy: offset at the end of the path, z: seconds to travel it (0 for none), w: phase in periods
+uniform bool bounce;    // come back along the path instead of starting over
+
 // output data : used by fragment shader
 out vec3 fragColor;
+out vec4 fragShape;
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    float angle = spin.y + spin.x*time;
+    vec2 p = mat2(cos(angle), sin(angle), -sin(angle), cos(angle)) * vertexPosition.xy;
+    if(path.z > 0.0) {
+        float u = fract(time/path.z + path.w);
+        p += path.xy * (bounce ? 1.0 - abs(1.0 - 2.0*u) : u);
+    }
+    vec4 v = vec4(p, vertexPosition.z, 1); // Transform an homogeneous 4D vector
 
     // The color of each vertex will be interpolated
     // to produce the color of each fragment
     fragColor = vertexColor;
+    fragShape = vertexShape;
 
     // Output position of the vertex, in clip space : MVP * position
     gl_Position = MVP * v;
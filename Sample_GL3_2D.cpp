@@ -2,22 +2,207 @@
 #include <cmath>
 #include <fstream>
 #include <vector>
+#include <map>
 #include <string.h>
+#include <stdint.h>
+#include <chrono>
 #include <GL/glew.h>
 #include <GL/glu.h>
 #include <GL/freeglut.h>
+#include "gl_trace.h"
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "game_sim.h"
+#include "game_env.h"
+#include "shot_index.h"
+#include "rewind_buffer.h"
+#include "geometry.h"
+#include "collision.h"
+#include "shot_journal.h"
+#include "aligned_array.h"
+#include "job_system.h"
+#include "world_chunks.h"
+#include "spatial_grid.h"
+#include "trace_zones.h"
+
 using namespace std;
 
+/* Live GPU resource accounting, kept up to date by the handles below */
+struct GPUResourceStats {
+    long buffers;
+    long vertex_arrays;
+    long programs;
+    long buffer_bytes;      // storage held by live buffers
+    long pooled_buffers;    // released buffers kept around for reuse
+    long pooled_bytes;
+    long recycled;          // buffer requests served from the pool
+};
+typedef struct GPUResourceStats GPUResourceStats;
+
+GPUResourceStats gpu_stats;
+
+/* Released buffers are kept by size class instead of being deleted, so that
+   objects rebuilt after a level reset reuse the storage of the ones they replace */
+map<GLsizeiptr, vector<GLuint> > buffer_pool;
+
+GLsizeiptr buffer_size_class (GLsizeiptr bytes)
+{
+    GLsizeiptr size = 64;
+    while(size < bytes)
+        size *= 2;
+    return size;
+}
+
+/* Move-only owner of a buffer object, storage comes from and goes back to buffer_pool */
+class GLBuffer {
+public:
+    GLBuffer () : id_(0), capacity_(0) {}
+    GLBuffer (GLenum target, GLsizeiptr bytes, const void* data) : capacity_(buffer_size_class(bytes))
+    {
+        vector<GLuint>& free_list = buffer_pool[capacity_];
+        if(!free_list.empty()) {
+            id_ = free_list.back();
+            free_list.pop_back();
+            gpu_stats.pooled_buffers--;
+            gpu_stats.pooled_bytes -= capacity_;
+            gpu_stats.recycled++;
+            glBindBuffer(target, id_);
+        }
+        else {
+            glGenBuffers(1, &id_);
+            glBindBuffer(target, id_);
+            glBufferData(target, capacity_, NULL, GL_STATIC_DRAW);
+        }
+        glBufferSubData(target, 0, bytes, data);
+        gpu_stats.buffers++;
+        gpu_stats.buffer_bytes += capacity_;
+    }
+    GLBuffer (GLBuffer&& other) : id_(other.id_), capacity_(other.capacity_) { other.id_ = 0; }
+    GLBuffer& operator= (GLBuffer&& other)
+    {
+        if(this != &other) {
+            reset();
+            id_ = other.id_;
+            capacity_ = other.capacity_;
+            other.id_ = 0;
+        }
+        return *this;
+    }
+    GLBuffer (const GLBuffer&) = delete;
+    GLBuffer& operator= (const GLBuffer&) = delete;
+    ~GLBuffer () { reset(); }
+
+    void reset ()
+    {
+        if(id_ == 0)
+            return;
+        buffer_pool[capacity_].push_back(id_);
+        gpu_stats.buffers--;
+        gpu_stats.buffer_bytes -= capacity_;
+        gpu_stats.pooled_buffers++;
+        gpu_stats.pooled_bytes += capacity_;
+        id_ = 0;
+    }
+    GLuint id () const { return id_; }
+
+private:
+    GLuint id_;
+    GLsizeiptr capacity_;
+};
+
+/* Deletes every buffer parked in the pool */
+void trim_buffer_pool ()
+{
+    for(map<GLsizeiptr, vector<GLuint> >::iterator it=buffer_pool.begin(); it!=buffer_pool.end(); it++)
+    {
+        if(!it->second.empty())
+            glDeleteBuffers(it->second.size(), &it->second[0]);
+        gpu_stats.pooled_buffers -= it->second.size();
+        gpu_stats.pooled_bytes -= it->first*it->second.size();
+    }
+    buffer_pool.clear();
+}
+
+/* Move-only owner of a vertex array object */
+class GLVertexArray {
+public:
+    GLVertexArray () : id_(0) {}
+    explicit GLVertexArray (GLuint id) : id_(id) { if(id_) gpu_stats.vertex_arrays++; }
+    GLVertexArray (GLVertexArray&& other) : id_(other.id_) { other.id_ = 0; }
+    GLVertexArray& operator= (GLVertexArray&& other)
+    {
+        if(this != &other) {
+            reset();
+            id_ = other.id_;
+            other.id_ = 0;
+        }
+        return *this;
+    }
+    GLVertexArray (const GLVertexArray&) = delete;
+    GLVertexArray& operator= (const GLVertexArray&) = delete;
+    ~GLVertexArray () { reset(); }
+
+    void reset ()
+    {
+        if(id_ == 0)
+            return;
+        glDeleteVertexArrays(1, &id_);
+        gpu_stats.vertex_arrays--;
+        id_ = 0;
+    }
+    GLuint id () const { return id_; }
+
+private:
+    GLuint id_;
+};
+
+/* Move-only owner of a linked shader program */
+class GLProgram {
+public:
+    GLProgram () : id_(0) {}
+    explicit GLProgram (GLuint id) : id_(id) { if(id_) gpu_stats.programs++; }
+    GLProgram (GLProgram&& other) : id_(other.id_) { other.id_ = 0; }
+    GLProgram& operator= (GLProgram&& other)
+    {
+        if(this != &other) {
+            reset();
+            id_ = other.id_;
+            other.id_ = 0;
+        }
+        return *this;
+    }
+    GLProgram (const GLProgram&) = delete;
+    GLProgram& operator= (const GLProgram&) = delete;
+    ~GLProgram () { reset(); }
+
+    void reset ()
+    {
+        if(id_ == 0)
+            return;
+        glDeleteProgram(id_);
+        gpu_stats.programs--;
+        id_ = 0;
+    }
+    GLuint id () const { return id_; }
+
+private:
+    GLuint id_;
+};
+
 struct VAO {
-    GLuint VertexArrayID;
+    GLVertexArray VertexArray;  // owned GL objects, the buffers stay empty when shared
+    GLBuffer VertexStorage;
+    GLBuffer ColorStorage;
+    GLBuffer ShapeStorage;      // circles only
+
+    GLuint VertexArrayID;       // names bound when drawing
     GLuint VertexBuffer;
     GLuint ColorBuffer;
+    GLuint ShapeBuffer;
 
     GLenum PrimitiveMode;
     GLenum FillMode;
@@ -38,66 +223,95 @@ struct GLMatrices {
 	GLuint MatrixID;
 } Matrices;
 
-GLuint programID;
+GLProgram programID;
 
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+/* Startup phase timings, reported once the first frame is on screen */
+enum StartupPhase { PHASE_GLUT, PHASE_GLEW, PHASE_GEOMETRY, PHASE_SHADERS, NUM_STARTUP_PHASES };
+const char *startup_phase_names[NUM_STARTUP_PHASES] = { "GLUT init", "GLEW", "geometry", "shaders" };
+double startup_phase_ms[NUM_STARTUP_PHASES];
+chrono::steady_clock::time_point startup_begin;
+bool startup_reported = false;
+
+double elapsed_ms (chrono::steady_clock::time_point since)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+/* Compiles one shader stage from a file, the log is printed like LoadShaders does */
+GLuint CompileShader(GLenum type, const char * file_path) {
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
+	TraceZone zone("compile shader");
+	GLuint ShaderID = glCreateShader(type);
+
+	std::string ShaderCode;
+	std::ifstream ShaderStream(file_path, std::ios::in);
+	if(ShaderStream.is_open())
 	{
 		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+		while(getline(ShaderStream, Line))
+			ShaderCode += "\n" + Line;
+		ShaderStream.close();
 	}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
-	}
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	printf("Compiling shader : %s\n", file_path);
+	char const * SourcePointer = ShaderCode.c_str();
+	glShaderSource(ShaderID, 1, &SourcePointer , NULL);
+	glCompileShader(ShaderID);
+
+	glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	std::vector<char> ShaderErrorMessage( max(InfoLogLength, int(1)) );
+	glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+	fprintf(stdout, "%s\n", &ShaderErrorMessage[0]);
+
+	return ShaderID;
+}
+
+/* Vertex shader only program whose outputs are captured by transform feedback, interleaved
+   in the order of 'varyings'. Returns 0 when it does not link */
+GLuint LoadFeedbackShader(const char * vertex_file_path, const char ** varyings, int num_varyings) {
+
+	TraceZone zone("load feedback shader");
+	GLuint VertexShaderID = CompileShader(GL_VERTEX_SHADER, vertex_file_path);
+
+	fprintf(stdout, "Linking program\n");
+	GLuint ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, VertexShaderID);
+	glTransformFeedbackVaryings(ProgramID, num_varyings, varyings, GL_INTERLEAVED_ATTRIBS);
+	glLinkProgram(ProgramID);
 
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
+	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+	fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
+
+	glDeleteShader(VertexShaderID);
+	if(Result != GL_TRUE) {
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
+
+/* Function to load Shaders - Use it as it is */
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+
+	TraceZone zone("load shaders");
+	// Compile the shaders
+	GLuint VertexShaderID = CompileShader(GL_VERTEX_SHADER, vertex_file_path);
+	GLuint FragmentShaderID = CompileShader(GL_FRAGMENT_SHADER, fragment_file_path);
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
-
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
 
 	// Link the program
+	TraceZone link_zone("link program");
 	fprintf(stdout, "Linking program\n");
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
@@ -117,22 +331,158 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	return ProgramID;
 }
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* Per-frame scratch memory - a linear arena that is reset at the top of every frame.
+   Transient transforms and draw data are carved out of it instead of the stack */
+#define FRAME_ARENA_BYTES (256*1024)
+#define FRAME_ARENA_MAX_BYTES (16*1024*1024)    // it never grows past this, bigger frames draw immediately
+struct FrameArena {
+    char* base;
+    size_t capacity;
+    size_t max_capacity;
+    size_t used;
+    size_t last_frame;  // bytes used by the previous frame
+    size_t peak;
+    long overflows;     // requests refused because the arena was full
+    size_t shortfall;   // bytes refused this frame, the arena grows by them before the next, up to max_capacity
+};
+typedef struct FrameArena FrameArena;
+
+FrameArena frame_arena;
+
+void init_frame_arena (FrameArena& arena, size_t bytes)
+{
+    arena.base = (char*) malloc(bytes);
+    arena.capacity = arena.base ? bytes : 0;
+    arena.max_capacity = max(bytes, (size_t)FRAME_ARENA_MAX_BYTES);
+    arena.used = 0;
+    arena.last_frame = 0;
+    arena.peak = 0;
+    arena.overflows = 0;
+    arena.shortfall = 0;
+}
+
+void reset_frame_arena (FrameArena& arena)
+{
+    arena.last_frame = arena.used;
+    if(arena.used > arena.peak)
+        arena.peak = arena.used;
+    arena.used = 0;
+    // nothing in the arena outlives a frame, so a frame that did not fit can grow it in place
+    if(arena.shortfall && arena.capacity < arena.max_capacity)
+    {
+        size_t bytes = min(max(arena.capacity*2, arena.capacity + arena.shortfall), arena.max_capacity);
+        char* base = (char*) malloc(bytes);
+        if(base)
+        {
+            free(arena.base);
+            arena.base = base;
+            arena.capacity = bytes;
+        }
+    }
+    arena.shortfall = 0;
+}
+
+/* Returns NULL when the request does not fit, callers must handle it */
+void* arena_alloc (FrameArena& arena, size_t bytes, size_t align)
+{
+    size_t offset = (arena.used + align-1) & ~(align-1);
+    if(offset + bytes > arena.capacity) {
+        arena.overflows++;
+        arena.shortfall += bytes + align;
+        return NULL;
+    }
+    arena.used = offset + bytes;
+    return arena.base + offset;
+}
+
+template <typename T>
+T* arena_array (FrameArena& arena, size_t count)
+{
+    return (T*) arena_alloc(arena, count*sizeof(T), alignof(T));
+}
+
+/* Pooled allocator for VAO handles - handles are carved out of fixed-size blocks
+   and their GL names are generated a whole block at a time. Freed handles keep
+   their vertex array name and go back on the free list */
+#define VAO_POOL_BLOCK 32
+struct VAOPool {
+    vector<VAO*> blocks;
+    vector<VAO*> free;
+    int used;
+    int capacity;
+};
+typedef struct VAOPool VAOPool;
+
+VAOPool object_pool = { vector<VAO*>(), vector<VAO*>(), 0, 0 };
+
+VAO* pool_alloc_vao (VAOPool& pool)
+{
+    if (!pool.free.empty()) {
+        VAO* vao = pool.free.back();
+        pool.free.pop_back();
+        return vao;
+    }
+    if (pool.used == pool.capacity) {
+        VAO* block = new VAO [VAO_POOL_BLOCK];
+        GLuint ids [VAO_POOL_BLOCK];
+        glGenVertexArrays(VAO_POOL_BLOCK, ids);
+        for (int k=0; k<VAO_POOL_BLOCK; k++) {
+            block[k].VertexArray = GLVertexArray(ids[k]);
+            block[k].VertexArrayID = ids[k];
+            block[k].ShapeBuffer = 0;
+        }
+        pool.blocks.push_back(block);
+        pool.capacity += VAO_POOL_BLOCK;
+    }
+    VAO* vao = &pool.blocks[pool.used/VAO_POOL_BLOCK][pool.used%VAO_POOL_BLOCK];
+    pool.used++;
+    return vao;
+}
+
+/* Returns the handle to its pool, its buffers go back to the buffer pool */
+void pool_free_vao (VAOPool& pool, VAO* vao)
 {
-    struct VAO* vao = new struct VAO;
+    vao->VertexStorage.reset();
+    vao->ColorStorage.reset();
+    if(vao->ShapeBuffer)
+    {
+        // the next owner may not be a circle
+        glBindVertexArray(vao->VertexArrayID);
+        glDisableVertexAttribArray(2);
+        vao->ShapeStorage.reset();
+    }
+    vao->VertexBuffer = 0;
+    vao->ColorBuffer = 0;
+    vao->ShapeBuffer = 0;
+    pool.free.push_back(vao);
+}
+
+/* Destroys every handle of the pool along with its GL objects */
+void pool_release (VAOPool& pool)
+{
+    for (size_t b=0; b<pool.blocks.size(); b++)
+        delete [] pool.blocks[b];
+    pool.blocks.clear();
+    pool.free.clear();
+    pool.used = 0;
+    pool.capacity = 0;
+}
+
+/* Generate VAO, VBOs and return VAO handle, through the renderer in use */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL);
+
+/* GL back end of create3DObject */
+struct VAO* gl_create_object (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode)
+{
+    struct VAO* vao = pool_alloc_vao(object_pool);
     vao->PrimitiveMode = primitive_mode;
     vao->NumVertices = numVertices;
     vao->FillMode = fill_mode;
 
-    // Create Vertex Array Object
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
     glBindVertexArray (vao->VertexArrayID); // Bind the VAO
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+    // Copy the vertices into a VBO from the buffer pool, this leaves it bound
+    vao->VertexStorage = GLBuffer(GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data);
+    vao->VertexBuffer = vao->VertexStorage.id();
     glVertexAttribPointer(
                           0,                  // attribute 0. Vertices
                           3,                  // size (x,y,z)
@@ -142,8 +492,9 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
                           (void*)0            // array buffer offset
                           );
 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
+    // Copy the vertex colors
+    vao->ColorStorage = GLBuffer(GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data);
+    vao->ColorBuffer = vao->ColorStorage.id();
     glVertexAttribPointer(
                           1,                  // attribute 1. Color
                           3,                  // size (r,g,b)
@@ -156,48 +507,487 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     return vao;
 }
 
+/* Typed upload of a compile-time mesh, the vertex count comes with its type */
+template <int N>
+struct VAO* create3DObject (GLenum primitive_mode, const Mesh<N>& mesh, const MeshColors<N>& colors, GLenum fill_mode=GL_FILL)
+{
+    return create3DObject(primitive_mode, N, mesh.positions, colors.rgb, fill_mode);
+}
+
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+    vector<GLfloat> color_buffer_data (3*numVertices);
     for (int i=0; i<numVertices; i++) {
         color_buffer_data [3*i] = red;
         color_buffer_data [3*i + 1] = green;
         color_buffer_data [3*i + 2] = blue;
     }
 
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
+}
+
+/* Circles are one quad each, Sample_GL.frag cuts the disc or outline out of it from the
+   distance to the centre with antialiased edges. Attribute 2 carries the position in radii,
+   the kind and the number of spokes an outline gets (the look of the old wireframe fans).
+   Objects without it read the generic value (0,0,0,1) and are filled as before */
+enum CircleKind { CIRCLE_FILL, CIRCLE_DISC, CIRCLE_OUTLINE };
+#define CIRCLE_QUAD_EXTENT 1.25f // half size of the quad in radii, room for the soft edge
+#define CIRCLE_VERTICES 6
+
+/* Points attribute 2 of the bound VAO at 'buffer' */
+void bind_circle_shape (GLuint buffer)
+{
+    glBindBuffer (GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(2);
+}
+
+/* Gives a VAO made by create3DObject its own shape attribute, through the renderer in use */
+void attach_circle_shape (struct VAO* vao, const CircleShape& shape);
+
+/* GL back end of attach_circle_shape */
+void gl_attach_circle_shape (struct VAO* vao, const CircleShape& shape)
+{
+    glBindVertexArray (vao->VertexArrayID);
+    vao->ShapeStorage = GLBuffer(GL_ARRAY_BUFFER, sizeof(shape.values), shape.values);
+    vao->ShapeBuffer = vao->ShapeStorage.id();
+    bind_circle_shape(vao->ShapeBuffer);
+}
+
+/* GPU timing - GL_TIME_ELAPSED queries wrapped around each draw group.
+   Queries live in a ring and are only read back once the driver reports them available */
+enum DrawGroup { GROUP_WORLD, GROUP_COINS, GROUP_BALL_CANON, GROUP_PARTICLES, GROUP_HUD, NUM_DRAW_GROUPS };
+const char *draw_group_names[NUM_DRAW_GROUPS] = { "static world", "coins", "ball/cannon", "particles", "HUD" };
+#define GPU_QUERY_RING 4
+
+struct GPUTimers {
+    bool supported;
+    GLuint queries[GPU_QUERY_RING][NUM_DRAW_GROUPS];
+    bool pending[GPU_QUERY_RING][NUM_DRAW_GROUPS];
+    int slot;           // ring slot used by the current frame
+    int group;          // group being drawn, -1 when none
+    bool active;        // a query is open for the current group
+    long dropped;       // frames not timed because their slot was still in flight
+
+    long samples[NUM_DRAW_GROUPS];
+    double total_ms[NUM_DRAW_GROUPS];
+    double min_ms[NUM_DRAW_GROUPS];
+    double max_ms[NUM_DRAW_GROUPS];
+    long frame_vertices[NUM_DRAW_GROUPS];
+    long total_vertices[NUM_DRAW_GROUPS];
+    long frames;                        // frames begun, all but the current one are in total_vertices
+
+    double slot_ms[GPU_QUERY_RING];     // GPU time of the frame in each slot, complete once all groups are in
+    int slot_groups[GPU_QUERY_RING];
+    double last_frame_ms;               // GPU time of the latest complete frame
+};
+typedef struct GPUTimers GPUTimers;
+
+GPUTimers gpu_timers;
+
+void init_gpu_timers ()
+{
+    memset(&gpu_timers, 0, sizeof(gpu_timers));
+    gpu_timers.group = -1;
+    gpu_timers.supported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if(!gpu_timers.supported)
+    {
+        cout<<"GPU timer queries not supported, GPU timing disabled"<<endl;
+        return;
+    }
+    glGenQueries(GPU_QUERY_RING*NUM_DRAW_GROUPS, &gpu_timers.queries[0][0]);
+}
+
+/* Reads back every finished query, never waits on the GPU */
+void collect_gpu_timers ()
+{
+    if(!gpu_timers.supported)
+        return;
+    for(int k=0;k<GPU_QUERY_RING;k++)
+        for(int g=0;g<NUM_DRAW_GROUPS;g++)
+        {
+            if(!gpu_timers.pending[k][g])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(gpu_timers.queries[k][g], GL_QUERY_RESULT_AVAILABLE, &available);
+            if(!available)
+                continue;
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(gpu_timers.queries[k][g], GL_QUERY_RESULT, &ns);
+            double ms = ns/1.0e6;
+            if(gpu_timers.samples[g]==0 || ms < gpu_timers.min_ms[g])
+                gpu_timers.min_ms[g] = ms;
+            if(ms > gpu_timers.max_ms[g])
+                gpu_timers.max_ms[g] = ms;
+            gpu_timers.total_ms[g] += ms;
+            gpu_timers.samples[g]++;
+            gpu_timers.pending[k][g] = false;
+            gpu_timers.slot_ms[k] += ms;
+            if(++gpu_timers.slot_groups[k] == NUM_DRAW_GROUPS)
+                gpu_timers.last_frame_ms = gpu_timers.slot_ms[k];
+        }
+}
+
+/* Called once per frame before any group is timed */
+void next_gpu_timer_frame ()
+{
+    collect_gpu_timers();
+    for(int g=0;g<NUM_DRAW_GROUPS;g++)
+    {
+        gpu_timers.total_vertices[g] += gpu_timers.frame_vertices[g];
+        gpu_timers.frame_vertices[g] = 0;
+    }
+    gpu_timers.frames++;
+    gpu_timers.slot = (gpu_timers.slot+1) % GPU_QUERY_RING;
+    gpu_timers.slot_ms[gpu_timers.slot] = 0;
+    gpu_timers.slot_groups[gpu_timers.slot] = 0;
+}
+
+void begin_draw_group (DrawGroup group)
+{
+    gpu_timers.group = group;
+    if(!gpu_timers.supported)
+        return;
+    if(gpu_timers.pending[gpu_timers.slot][group])
+    {
+        // the GPU is more than a ring behind, skip this sample rather than stall
+        gpu_timers.dropped++;
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, gpu_timers.queries[gpu_timers.slot][group]);
+    gpu_timers.pending[gpu_timers.slot][group] = true;
+    gpu_timers.active = true;
+}
+
+void end_draw_group ()
+{
+    if(gpu_timers.active)
+        glEndQuery(GL_TIME_ELAPSED);
+    gpu_timers.active = false;
+    gpu_timers.group = -1;
+}
+
+/****************************************
+ * Render queue                         *
+ ****************************************/
+/* Draws are recorded as commands with a 64-bit sort key, sorted once per pass and handed
+   to a back end that remembers the GL state it last set and drops calls that would not
+   change it. Everything sits at z=0 with alpha-blended edges, so painter's order is the
+   only depth there is: the layer ranks above the state fields and within a layer draws
+   are grouped by program, fill mode and mesh. The sequence number keeps the sort stable.
+
+   key: group 63..60 | layer 59..52 | program 51..44 | fill 43 | mesh 42..18 | sequence 17..0 */
+#define KEY_GROUP_SHIFT 60
+#define KEY_LAYER_SHIFT 52
+#define KEY_PROGRAM_SHIFT 44
+#define KEY_FILL_SHIFT 43
+#define KEY_MESH_SHIFT 18
+#define KEY_SEQUENCE_MASK 0x3ffff
+#define RENDER_QUEUE_FIXED_DRAWS 16 // everything but the coins
+
+enum RenderState { STATE_PROGRAM, STATE_FILL_MODE, STATE_VERTEX_ARRAY, STATE_MVP, STATE_ANIMATION, STATE_ATTRIBUTES, NUM_RENDER_STATES };
+const char *render_state_names[NUM_RENDER_STATES] = { "program", "fill mode", "vertex array", "MVP", "animation", "attributes" };
+
+/* Motion that is a function of time alone, drawn by Sample_GL.vert from the time uniform:
+   the model turns about its origin and is moved along a straight path that loops or goes
+   back and forth. The MVP of such a draw leaves the motion out. animation_angle and
+   animation_offset are the same formula for the CPU */
+struct Animation {
+    float spin_rate;    // rad/s
+    float spin_phase;   // rad
+    float path_x, path_y;   // offset at the end of the path
+    float period;       // seconds to travel the path, 0 stays put
+    float path_phase;   // in periods
+    bool bounce;        // come back along the path instead of starting over
+};
+typedef struct Animation Animation;
+
+struct AnimationUniforms {
+    GLint time, spin, path, bounce;
+} animation_uniforms;
+
+#define ANIMATION_FRAME_RATE 60     // the per-frame steps the motions below were made for
+#define TRAP_LOW -2.5
+#define TRAP_HIGH 0.5
+
+const Animation still = { 0, 0, 0, 0, 0, 0, false };
+// coins turned 6 degrees a frame clockwise
+const Animation coin_animation = { (float)(-6*ANIMATION_FRAME_RATE*M_PI/180), 0, 0, 0, 0, 0, false };
+// the wheel rolled 0.017 a frame from 0 to -4.1 and started over at 4.25, turning a degree a frame
+const Animation wheel_animation = { (float)(ANIMATION_FRAME_RATE*M_PI/180), 0, -8.35, 0,
+                                    (float)(8.35/(0.017*ANIMATION_FRAME_RATE)), (float)(4.25/8.35), false };
+// the trap goes between TRAP_LOW and TRAP_HIGH at 0.01 a frame, from 0 going up
+const Animation trap_animation = { 0, 0, 0, TRAP_HIGH-TRAP_LOW, (float)(2*(TRAP_HIGH-TRAP_LOW)/(0.01*ANIMATION_FRAME_RATE)),
+                                   (float)(-TRAP_LOW/(TRAP_HIGH-TRAP_LOW)/2), true };
+
+double frame_time = 0;      // the time uniform of this frame, the physics tick it shows at ANIMATION_FRAME_RATE
+
+double animation_angle (const Animation& animation, double time)
+{
+    return animation.spin_phase + animation.spin_rate*time;
+}
+
+glm::vec2 animation_offset (const Animation& animation, double time)
+{
+    if(animation.period <= 0)
+        return glm::vec2(0, 0);
+    double u = time/animation.period + animation.path_phase;
+    u -= floor(u);
+    float along = animation.bounce ? 1 - fabs(1 - 2*u) : u;
+    return glm::vec2(animation.path_x*along, animation.path_y*along);
+}
+
+struct RenderCommand {
+    uint64_t key;
+    glm::mat4 MVP;
+    struct VAO* vao;
+    const Animation* animation;
+    GLuint program;
+};
+typedef struct RenderCommand RenderCommand;
+
+/* Commands of the current pass, carved out of the frame arena */
+struct RenderQueue {
+    RenderCommand* commands;
+    int count;
+    int capacity;
+};
+typedef struct RenderQueue RenderQueue;
+
+/* What the back end last set, only valid within one submission */
+struct RenderStateCache {
+    GLuint program;
+    GLenum fill_mode;
+    GLuint vertex_array;
+    glm::mat4 MVP;
+    bool have_MVP;
+    const Animation* animation;
+};
+typedef struct RenderStateCache RenderStateCache;
+
+struct RenderStats {
+    long commands;      // recorded into the queue
+    long immediate;     // drawn straight away because the queue was full
+    long submitted[NUM_RENDER_STATES];
+    long skipped[NUM_RENDER_STATES];
+};
+typedef struct RenderStats RenderStats;
+
+RenderQueue render_queue;
+RenderStateCache render_state;
+RenderStats render_stats, last_render_stats;
+
+/****************************************
+ * Renderer                             *
+ ****************************************/
+/* Everything the game asks of the graphics goes through here. GLRenderer is the GL 3.3 back
+   end, NullRenderer makes CPU-only objects and counts what it is given so --headless can run
+   the game with no window or context. Both are defined after initGL */
+class Renderer {
+public:
+    virtual ~Renderer () {}
+    virtual void init (int width, int height) = 0;
+    virtual struct VAO* create_object (GLenum primitive_mode, int num_vertices, const GLfloat* vertex_buffer_data,
+                                       const GLfloat* color_buffer_data, GLenum fill_mode) = 0;
+    virtual void attach_circle_shape (struct VAO* vao, const CircleShape& shape) = 0;
+    virtual struct VAO* create_coin_object () = 0;
+    virtual void release_object (struct VAO* vao) = 0;
+    virtual void resize (int width, int height) = 0;
+    virtual void begin_frame (float time) = 0;
+    virtual void begin_group (DrawGroup group) = 0;
+    virtual void draw (const RenderCommand* commands, int count) = 0;
+    virtual void end_group () = 0;
+    virtual void draw_particles (const glm::mat4& VP) = 0;
+    virtual void end_scene () = 0;
+    virtual void text (float x, float y, const string& str) = 0;
+    virtual void end_frame () = 0;
+    virtual void release () = 0;
+    virtual void print_stats () = 0;
+};
+
+Renderer* renderer = NULL;
+
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode)
+{
+    return renderer->create_object(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+}
+
+void attach_circle_shape (struct VAO* vao, const CircleShape& shape)
+{
+    renderer->attach_circle_shape(vao, shape);
+}
+
+void invalidate_render_state ()
+{
+    render_state = RenderStateCache();
+}
+
+void count_state (RenderState state, bool changed)
+{
+    if(changed)
+        render_stats.submitted[state]++;
+    else
+        render_stats.skipped[state]++;
 }
 
-/* Render the VBOs handled by VAO */
+/* Render the VBOs handled by VAO, setting only the state that differs from the last draw */
 void draw3DObject (struct VAO* vao)
 {
+    if(gpu_timers.group >= 0)
+        gpu_timers.frame_vertices[gpu_timers.group] += vao->NumVertices;
+
     // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    count_state(STATE_FILL_MODE, render_state.fill_mode != vao->FillMode);
+    if(render_state.fill_mode != vao->FillMode)
+    {
+        glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+        render_state.fill_mode = vao->FillMode;
+    }
 
     // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
-
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+    count_state(STATE_VERTEX_ARRAY, render_state.vertex_array != vao->VertexArrayID);
+    if(render_state.vertex_array != vao->VertexArrayID)
+    {
+        glBindVertexArray (vao->VertexArrayID);
+        render_state.vertex_array = vao->VertexArrayID;
+    }
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+    // attribute enables and buffer bindings were captured by the VAO when it was created,
+    // the two enables and two binds every draw used to repeat are never issued
+    render_stats.skipped[STATE_ATTRIBUTES] += 4;
 
     // Draw the geometry !
     glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
 }
 
+void execute_command (const RenderCommand& command)
+{
+    count_state(STATE_PROGRAM, render_state.program != command.program);
+    if(render_state.program != command.program)
+    {
+        glUseProgram (command.program);
+        render_state.program = command.program;
+    }
+    bool same_MVP = render_state.have_MVP && memcmp(&render_state.MVP, &command.MVP, sizeof(glm::mat4)) == 0;
+    count_state(STATE_MVP, !same_MVP);
+    if(!same_MVP)
+    {
+        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &command.MVP[0][0]);
+        render_state.MVP = command.MVP;
+        render_state.have_MVP = true;
+    }
+    count_state(STATE_ANIMATION, render_state.animation != command.animation);
+    if(render_state.animation != command.animation)
+    {
+        const Animation& animation = *command.animation;
+        glUniform2f(animation_uniforms.spin, animation.spin_rate, animation.spin_phase);
+        glUniform4f(animation_uniforms.path, animation.path_x, animation.path_y, animation.period, animation.path_phase);
+        glUniform1i(animation_uniforms.bounce, animation.bounce);
+        render_state.animation = command.animation;
+    }
+    draw3DObject(command.vao);
+}
+
+/* Starts recording a pass of at most 'capacity' commands */
+void begin_render_queue (RenderQueue& queue, int capacity)
+{
+    queue.commands = arena_array<RenderCommand>(frame_arena, capacity);
+    queue.capacity = queue.commands ? capacity : 0;
+    queue.count = 0;
+}
+
+/* A draw of 'vao' with the current program, 'sequence' orders it among equal keys */
+RenderCommand render_command (DrawGroup group, int layer, struct VAO* vao, const glm::mat4& MVP, int sequence,
+                              const Animation& animation=still)
+{
+    RenderCommand command;
+    command.program = programID.id();
+    command.vao = vao;
+    command.MVP = MVP;
+    command.animation = &animation;
+    command.key = (uint64_t)group << KEY_GROUP_SHIFT |
+                  (uint64_t)(layer & 0xff) << KEY_LAYER_SHIFT |
+                  (uint64_t)(command.program & 0xff) << KEY_PROGRAM_SHIFT |
+                  (uint64_t)(vao->FillMode == GL_LINE) << KEY_FILL_SHIFT |
+                  (uint64_t)(vao->VertexArrayID & 0x1ffffff) << KEY_MESH_SHIFT |
+                  (uint64_t)(sequence & KEY_SEQUENCE_MASK);
+    return command;
+}
+
+/* Records a draw of 'vao' with the current program in draw group 'group', lower layers are drawn first */
+void queue_draw (RenderQueue& queue, DrawGroup group, int layer, struct VAO* vao, const glm::mat4& MVP,
+                 const Animation& animation=still)
+{
+    RenderCommand command = render_command(group, layer, vao, MVP, queue.count, animation);
+    render_stats.commands++;
+    if(queue.count == queue.capacity)
+    {
+        // arena exhausted, draw straight away with the state the back end knows about
+        render_stats.immediate++;
+        renderer->draw(&command, 1);
+        return;
+    }
+    queue.commands[queue.count++] = command;
+}
+
+/* Sorts by key. Passes are recorded group by group and a coin pass comes out in key order,
+   so only the groups that are out of order get sorted */
+void sort_render_commands (RenderCommand* commands, int count)
+{
+    auto by_key = [](const RenderCommand& a, const RenderCommand& b) { return a.key < b.key; };
+    auto by_group = [](const RenderCommand& a, const RenderCommand& b) { return a.key >> KEY_GROUP_SHIFT < b.key >> KEY_GROUP_SHIFT; };
+    int sorted = is_sorted_until(commands, commands + count, by_key) - commands;
+    if(sorted == count)
+        return;
+    if(!is_sorted(commands + sorted - 1, commands + count, by_group))
+    {
+        sort(commands, commands + count, by_key);
+        return;
+    }
+    // groups that ended before the first key out of order are done
+    int group_begin = sorted - 1;
+    while(group_begin > 0 && (commands[group_begin-1].key >> KEY_GROUP_SHIFT) == (commands[sorted-1].key >> KEY_GROUP_SHIFT))
+        group_begin--;
+    for(int begin=group_begin, end; begin<count; begin=end)
+    {
+        for(end=begin+1; end<count && (commands[end].key >> KEY_GROUP_SHIFT) == (commands[begin].key >> KEY_GROUP_SHIFT); end++)
+            ;
+        if(!is_sorted(commands + begin, commands + end, by_key))
+            sort(commands + begin, commands + end, by_key);
+    }
+}
+
+/* Sorts the pass and hands it to the renderer a group at a time, every group from 'first'
+   to 'last' is begun and ended even when it is empty so its timer keeps its place */
+void submit_render_queue (RenderQueue& queue, DrawGroup first, DrawGroup last)
+{
+    sort_render_commands(queue.commands, queue.count);
+    int c = 0;
+    for(int g=first; g<=last; g++)
+    {
+        int begin = c;
+        for(; c<queue.count && (int)(queue.commands[c].key >> KEY_GROUP_SHIFT) == g; c++)
+            ;
+        renderer->begin_group((DrawGroup) g);
+        renderer->draw(queue.commands + begin, c - begin);
+        renderer->end_group();
+    }
+    queue.count = 0;
+}
+
+/* Moves this frame's counters to last_render_stats for printing */
+void next_render_stats_frame ()
+{
+    last_render_stats = render_stats;
+    memset(&render_stats, 0, sizeof(render_stats));
+}
+
 /**************************
  * Customizable functions *
  **************************/
 int num_coin =6 ;
 float camera_rotation_angle = 90;
-float bird1_rot_dir = 1;
 float bird2_rot_dir = -1;
 float bird3_rot_dir = 1;
 float rectangle_rot_dir = 1;
@@ -205,12 +995,9 @@ float rectangle2_rot_dir = 1;
 float rectangle3_rot_dir = 1;
 float rectangle4_rot_dir = 1;
 float rectangle5_rot_dir = 1;
-float coins_rot_dir[500] ;
 float canon_rot_dir = 1;
-bool bird1_rot_status = true;
 bool bird2_rot_status = false;
 bool bird3_rot_status = true;
-bool coins_rot_status[500];
 bool rectangle_rot_status = false;
 bool rectangle2_rot_status = false;
 bool rectangle3_rot_status = false;
@@ -222,10 +1009,8 @@ float rectangle2_rotation = 0;
 float rectangle3_rotation = 0;
 float rectangle4_rotation = 0;
 float rectangle5_rotation = 0;
-float bird1_rotation = 0;
 float bird2_rotation = 0;
 float bird3_rotation = 0;
-float coins_rotation[500];
 float canon_rotation = 20;
 float power = 8 ;
 float power_meter = 8 ;
@@ -237,6 +1022,8 @@ double o=0;
 double theta = 0 ;
 double collisionx = 0;
 double collisiony = 0;
+double launch_x = 0; // where shots start, from the canon's home at (-3,-3), only --world moves it
+double launch_y = 0;
 double accelarationx = 0;
 double accelarationy =0 ;
 double gravity = -10 ;
@@ -249,35 +1036,93 @@ double vy =0;
 double finalx =0 ;
 double finaly =0 ;
 double direction =9 ;
-double moving_wheelx =0;
 double energy =0;
-double ex=0; // friction_coefficient at x axis
-double ey=0; // friction coefficient at y axis
+double ex=0; // friction coefficient along the surface last hit
+double ey=0; // friction coefficient across the surface last hit
 double radius_coins=.10f; // radius of angry coins
 double radius_object=.30f ;  // radius of angryobject
-double centerx_coin[500] ;
-double centery_coin[500] ;
+AlignedArray<double> centerx_coin;  // per-coin arrays are indexed from 1 and grown by ensure_coins
+AlignedArray<double> centery_coin;
 int score=0;
-bool flag_coin[500] ;
+AlignedArray<bool> flag_coin;
+#define COIN_GRID_CELL 0.25f
+PointGrid coin_grid(COIN_GRID_CELL); // every coin placed so far, by position, for the swept collection
+double sweep_x=0; // ball position collect_coins saw last
+double sweep_y=0;
+bool sweep_valid=false; // cleared when the ball jumps, the next sweep starts where it lands
 double zoom =0 ;
-float panx=0;
+float panx=0; // camera pan, in pixels of the original 600 pixel wide view
 float pany=0;
+bool camera_follow = false; // c toggles it, --world turns it on
+float follow_x=0; // where the following camera has got to, in world units
+float follow_y=0;
+float view_half_x=4; // half the view in world units, set by reshapeWindow
+float view_half_y=4;
+int window_width=600;
+int window_height=600;
 float mousex=0;
 float mousey=0;
 Point *mousePos;
 int level=1;
 double trappy=0;
 double dir=1; // direction of trappy box
+ShotIndex shot_index;
+ChunkedWorld world; // --world, see World streaming
+bool deterministic_physics = false;
+uint64_t sim_seed = 0;
+FILE* hash_log = NULL;
+SimState sim;
+vector<uint64_t> shot_ticks; // ticks recorded just before each shot, for undo
+
+uint64_t game_tick = 0;
+
+ShotJournalWriter shot_journal;
+ShotRecord current_shot; // the shot in flight, journaled once its outcome is known
+bool shot_in_flight = false;
+uint64_t shot_start_tick = 0;
+
+/* Hands the shot in flight to the journal writer, the file is written on its own thread */
+void journal_shot_end(ShotOutcome outcome){
+    if(!shot_in_flight)
+        return;
+    current_shot.ticks = game_tick - shot_start_tick;
+    current_shot.outcome = outcome;
+    shot_journal.append(current_shot);
+    shot_in_flight = false;
+}
+
+void journal_shot_begin(){
+    journal_shot_end(SHOT_REFIRED);
+    memset(&current_shot, 0, sizeof(current_shot));
+    current_shot.rotation = canon_rotation;
+    current_shot.power = power_meter;
+    shot_start_tick = game_tick;
+    shot_in_flight = true;
+}
 
 void shoot_func(){
+    shot_ticks.push_back(game_tick);
+    journal_shot_begin();
+    if(deterministic_physics)
+    {
+        sim_shoot(sim, FX(canon_rotation), FX(power_meter));
+        return;
+    }
+    // in a streamed world the shot starts where the ball came to rest, the canon goes with it
+    if(world.active() && !shoot)
+    {
+        launch_x = collisionx + newx;
+        launch_y = collisiony + newy;
+    }
     shoot = true ;
     flying_time = -987;
     theta = (canon_rotation)*M_PI/180.0f ;
     power = power_meter ;
-    collisionx =0 ;
+    collisionx = launch_x ;
     newy =0 ;
     newx =0 ;
-    collisiony =0 ;
+    collisiony = launch_y ;
+    sweep_valid = false;
     ux = power*cos(theta);
     vx=0;
     uy = power*(sin(theta));
@@ -287,16 +1132,54 @@ void shoot_func(){
     return;
 }
 
+/* Puts the ball back where the shot started, at rest */
+void return_ball(){
+    shoot = false;
+    collisionx = launch_x;
+    collisiony = launch_y;
+    newx = newy = 0;
+    ux = uy = vx = vy = 0;
+    energy = 0;
+    sweep_valid = false;
+}
+
 void reshapeWindow(int width,int height);
+void print_stats();
+void print_hint();
+bool autoplay_active();
+void undo_shot();
+
+/* --trace FILE records trace zones, the file is rewritten with everything so far on t and at exit */
+const char* trace_path = NULL;
+
+void write_trace ()
+{
+    if(trace_path == NULL)
+    {
+        cout<<"Start with --trace FILE to record a timeline"<<endl;
+        return;
+    }
+    if(tracer.write(trace_path))
+        printf("Trace of %zu events written to %s\n", tracer.events(), trace_path);
+    else
+        cout<<"Could not write trace "<<trace_path<<endl;
+}
 
 void exit_func(){
+    journal_shot_end(SHOT_QUIT);
+    shot_journal.close();
+    if(shot_journal.lost())
+        cout<<"Shot journal: "<<shot_journal.lost()<<" shots could not be written"<<endl;
+    renderer->release();
+    if(trace_path)
+        write_trace();
     cout<<"Your final Score is "<<score<<endl;
     cout<<"Level = "<<level<<endl;
     cout<<"Thanks For Playing"<<endl;
     exit (0);
 }
 /* Executed when a regular key is pressed */
-void keyboardUp (unsigned char key, int x, int y)
+void apply_key_up (unsigned char key, int x, int y)
 {
     switch (key) {
         case 'Q':
@@ -309,7 +1192,7 @@ void keyboardUp (unsigned char key, int x, int y)
 }
 
 /* Executed when a regular key is released */
-void keyboardDown (unsigned char key, int x, int y)
+void apply_key_down (unsigned char key, int x, int y)
 {
     switch (key) {
         case 'a':
@@ -333,47 +1216,62 @@ void keyboardDown (unsigned char key, int x, int y)
         case 32:
             shoot_func();
         break;
+        case 'i':
+        case 'I':
+            print_stats();
+        break;
+        case 'h':
+        case 'H':
+            print_hint();
+        break;
+        case 'u':
+        case 'U':
+            undo_shot();
+        break;
+        case 'c':
+        case 'C':
+            camera_follow = !camera_follow;
+        break;
+        case 't':
+        case 'T':
+            write_trace();
+        break;
         default:
             break;
     }
 }
 
 /* Executed when a special key is pressed */
-void keyboardSpecialDown (int key, int x, int y)
+void apply_special_down (int key, int x, int y)
 {
 }
 
 /* Executed when a special key is released */
-void keyboardSpecialUp (int key, int x, int y)
+void apply_special_up (int key, int x, int y)
 {
     switch(key){
             case GLUT_KEY_UP:
                 if(zoom<=1)
                 {
                     zoom+=0.2f;
-                    reshapeWindow(600,600);
+                    reshapeWindow(window_width,window_height);
                 }
             break;
             case GLUT_KEY_DOWN:
             if(zoom>=-1)
             {
                 zoom-=0.2f;
-                reshapeWindow(600,600);
+                reshapeWindow(window_width,window_height);
             }
             break;
+            // panning only moves the camera, see camera_view
             case GLUT_KEY_RIGHT:
                 if(panx<=35)
-                {
                     panx+=3.5;
-                    reshapeWindow(600,600);
-                }
             break;
             case GLUT_KEY_LEFT:
                 if(panx>=-35)
-                {
                     panx-=3.5;
-                    reshapeWindow(600,600);
-                }
             break;
             case 32:
                 // if(shoot == false){
@@ -400,7 +1298,7 @@ void keyboardSpecialUp (int key, int x, int y)
 /* Executed when a mouse button 'button' is put into state 'state'
  at screen position ('x', 'y')
  */
-void mouseClick (int button, int state, int x, int y)
+void apply_mouse_click (int button, int state, int x, int y)
 {
     switch (button) {
         case GLUT_LEFT_BUTTON:
@@ -408,10 +1306,7 @@ void mouseClick (int button, int state, int x, int y)
         break;
         case GLUT_RIGHT_BUTTON:
             if(panx<=35)
-            {
                 panx+=3.5;
-                reshapeWindow(600,600);
-            }
         break;
         default:
             break;
@@ -421,17 +1316,241 @@ void mouseClick (int button, int state, int x, int y)
 /* Executed when the mouse moves to position ('x', 'y') */
 void mouseMotion (int x, int y)
 {
+    TraceZone zone("mouse motion");
+}
+
+/* Input queue - the GLUT callbacks only timestamp and queue their input, drain_input applies it
+   once per tick at the start of draw, so nothing changes halfway through a frame */
+enum InputType { INPUT_KEY_DOWN, INPUT_KEY_UP, INPUT_SPECIAL_DOWN, INPUT_SPECIAL_UP, INPUT_MOUSE_CLICK };
+
+struct InputEvent {
+    InputType type;
+    int key;        // key or mouse button
+    int state;      // mouse button state
+    int x, y;
+    chrono::steady_clock::time_point time;
+};
+typedef struct InputEvent InputEvent;
+
+vector<InputEvent> input_queue, input_drained;
+
+/* Input to photon latency: from the callback until the GPU has finished the first frame that
+   applied the event (a fence after its swap). Frames are polled at the start of the next ones,
+   so samples are an upper bound that excludes the display's own scanout */
+#define LATENCY_BUCKETS 10
+const double latency_bucket_ms[LATENCY_BUCKETS] = { 1, 2, 4, 8, 16, 32, 64, 128, 256, 1e30 };
+
+struct LatencyFrame {
+    GLsync fence;                   // 0 when sync objects are missing, the swap is taken as done
+    vector<chrono::steady_clock::time_point> arrivals;
+};
+typedef struct LatencyFrame LatencyFrame;
+
+struct InputLatency {
+    vector<chrono::steady_clock::time_point> applied;   // events applied by the frame being drawn
+    vector<LatencyFrame> in_flight;
+    long histogram[LATENCY_BUCKETS];
+    long samples;
+    double total_ms;
+    double max_ms;
+};
+typedef struct InputLatency InputLatency;
+
+InputLatency input_latency;
+
+void push_input (InputType type, int key, int state, int x, int y)
+{
+    InputEvent event = { type, key, state, x, y, chrono::steady_clock::now() };
+    input_queue.push_back(event);
+}
+
+void keyboardUp (unsigned char key, int x, int y) { TraceZone zone("key up"); push_input(INPUT_KEY_UP, key, 0, x, y); }
+void keyboardDown (unsigned char key, int x, int y) { TraceZone zone("key down"); push_input(INPUT_KEY_DOWN, key, 0, x, y); }
+void keyboardSpecialDown (int key, int x, int y) { TraceZone zone("special key down"); push_input(INPUT_SPECIAL_DOWN, key, 0, x, y); }
+void keyboardSpecialUp (int key, int x, int y) { TraceZone zone("special key up"); push_input(INPUT_SPECIAL_UP, key, 0, x, y); }
+void mouseClick (int button, int state, int x, int y) { TraceZone zone("mouse click"); push_input(INPUT_MOUSE_CLICK, button, state, x, y); }
+
+/* Applies every queued event in arrival order */
+void drain_input ()
+{
+    // handlers may exit or print, swap first so new input lands in an empty queue
+    input_drained.swap(input_queue);
+    for(size_t e=0;e<input_drained.size();e++)
+    {
+        const InputEvent& event = input_drained[e];
+        switch(event.type) {
+            case INPUT_KEY_DOWN: apply_key_down(event.key, event.x, event.y); break;
+            case INPUT_KEY_UP: apply_key_up(event.key, event.x, event.y); break;
+            case INPUT_SPECIAL_DOWN: apply_special_down(event.key, event.x, event.y); break;
+            case INPUT_SPECIAL_UP: apply_special_up(event.key, event.x, event.y); break;
+            case INPUT_MOUSE_CLICK: apply_mouse_click(event.key, event.state, event.x, event.y); break;
+        }
+        input_latency.applied.push_back(event.time);
+    }
+    input_drained.clear();
+}
+
+void record_latency (double ms)
+{
+    int b = 0;
+    while(ms >= latency_bucket_ms[b])
+        b++;
+    input_latency.histogram[b]++;
+    input_latency.samples++;
+    input_latency.total_ms += ms;
+    input_latency.max_ms = max(input_latency.max_ms, ms);
+}
+
+/* Turns frames the GPU has finished into latency samples, oldest first */
+void collect_latency ()
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    size_t done = 0;
+    for(; done<input_latency.in_flight.size(); done++)
+    {
+        LatencyFrame& frame = input_latency.in_flight[done];
+        if(frame.fence)
+        {
+            if(glClientWaitSync(frame.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                break;
+            glDeleteSync(frame.fence);
+        }
+        for(size_t a=0;a<frame.arrivals.size();a++)
+            record_latency(chrono::duration<double, milli>(now - frame.arrivals[a]).count());
+    }
+    input_latency.in_flight.erase(input_latency.in_flight.begin(), input_latency.in_flight.begin() + done);
+}
+
+/* Called right after the swap, fences the frame if it applied any input */
+void submit_latency_frame ()
+{
+    if(!input_latency.applied.empty())
+    {
+        input_latency.in_flight.push_back(LatencyFrame());
+        LatencyFrame& frame = input_latency.in_flight.back();
+        frame.fence = GLEW_ARB_sync ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+        frame.arrivals.swap(input_latency.applied);
+    }
+    collect_latency();
+}
+
+void release_latency_fences ()
+{
+    for(size_t f=0;f<input_latency.in_flight.size();f++)
+        if(input_latency.in_flight[f].fence)
+            glDeleteSync(input_latency.in_flight[f].fence);
+    input_latency.in_flight.clear();
+}
+
+void print_latency ()
+{
+    if(input_latency.samples == 0)
+        return;
+    printf("Input to photon latency, %ld events, avg %.2f ms, max %.2f ms:\n", input_latency.samples,
+           input_latency.total_ms/input_latency.samples, input_latency.max_ms);
+    double lower = 0;
+    for(int b=0;b<LATENCY_BUCKETS;b++)
+    {
+        if(input_latency.histogram[b])
+        {
+            if(b == LATENCY_BUCKETS-1)
+                printf("  >= %3.0f ms %6ld\n", lower, input_latency.histogram[b]);
+            else
+                printf("  %3.0f-%3.0f ms %6ld\n", lower, latency_bucket_ms[b], input_latency.histogram[b]);
+        }
+        lower = latency_bucket_ms[b];
+    }
+}
+
+
+/* View culling - planes bounding the visible part of the world, rebuilt from VP every frame */
+struct CullStats {
+    int visible;
+    int culled;
+};
+typedef struct CullStats CullStats;
+
+glm::vec4 view_planes[4];
+CullStats cull_stats, last_cull_stats;
+
+void extract_view_planes (const glm::mat4& VP)
+{
+    glm::vec4 row0 (VP[0][0], VP[1][0], VP[2][0], VP[3][0]);
+    glm::vec4 row1 (VP[0][1], VP[1][1], VP[2][1], VP[3][1]);
+    glm::vec4 row3 (VP[0][3], VP[1][3], VP[2][3], VP[3][3]);
+
+    // -clip.w <= clip.x <= clip.w and the same for y
+    view_planes[0] = row3 + row0;
+    view_planes[1] = row3 - row0;
+    view_planes[2] = row3 + row1;
+    view_planes[3] = row3 - row1;
+    for(int p=0;p<4;p++)
+    {
+        float len = sqrt(view_planes[p].x*view_planes[p].x + view_planes[p].y*view_planes[p].y);
+        if(len > 0)
+            view_planes[p] = view_planes[p]*(1.0f/len);
+    }
+}
+
+bool count_visible (bool visible)
+{
+    if(visible)
+        cull_stats.visible++;
+    else
+        cull_stats.culled++;
+    return visible;
+}
+
+/* Objects live in the z=0 plane, so only x and y take part in the tests. This one leaves
+   cull_stats alone so jobs can call it */
+bool in_view_circle (float cx, float cy, float r)
+{
+    for(int p=0;p<4;p++)
+        if(view_planes[p].x*cx + view_planes[p].y*cy + view_planes[p].w < -r)
+            return false;
+    return true;
 }
 
+bool visible_circle (float cx, float cy, float r)
+{
+    return count_visible(in_view_circle(cx, cy, r));
+}
+
+bool visible_box (float minx, float miny, float maxx, float maxy)
+{
+    for(int p=0;p<4;p++)
+    {
+        // corner of the box furthest along the plane normal
+        float px = view_planes[p].x >= 0 ? maxx : minx;
+        float py = view_planes[p].y >= 0 ? maxy : miny;
+        if(view_planes[p].x*px + view_planes[p].y*py + view_planes[p].w < 0)
+            return count_visible(false);
+    }
+    return count_visible(true);
+}
+
+/* Box given in model space, placed at (tx,ty) and rotated about that point */
+bool visible_rect (float tx, float ty, float rotation, float minx, float miny, float maxx, float maxy)
+{
+    if(rotation == 0)
+        return visible_box(tx+minx, ty+miny, tx+maxx, ty+maxy);
+    float rx = max(fabs(minx), fabs(maxx));
+    float ry = max(fabs(miny), fabs(maxy));
+    return visible_circle(tx, ty, sqrt(rx*rx + ry*ry));
+}
 
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (int width, int height)
 {
+	TraceZone zone("reshape window");
 	GLfloat fov = 90.0f;
 
-	// sets the viewport of openGL renderer
-	glViewport (0+panx, 0+pany, (GLsizei) width+5, (GLsizei) height);
+	window_width = max(width, 1);
+	window_height = max(height, 1);
+
+	// sets the viewport of the renderer, draw() sets it again for the offscreen target
+	renderer->resize (window_width, window_height);
 
 	// set the projection matrix as perspective/ortho
 	// Store the projection matrix in a variable for future use
@@ -439,180 +1558,454 @@ void reshapeWindow (int width, int height)
     // Perspective projection for 3D views
     // Matrices.projection = glm::perspective (fov, (GLfloat) width / (GLfloat) height, 0.1f, 500.0f);
 
-    // Ortho projection for 2D views
-    float x = -4.0f - zoom ;
-    float y = 4.0f + zoom;
-    Matrices.projection = glm::ortho(x, y, x, y, 0.1f, 500.0f);
+    // Ortho projection for 2D views, the shorter side of the window shows 8 units
+    float half = 4.0f + zoom;
+    float aspect = (float) window_width / window_height;
+    float half_x = aspect >= 1 ? half*aspect : half;
+    float half_y = aspect >= 1 ? half : half/aspect;
+    Matrices.projection = glm::ortho(-half_x, half_x, -half_y, half_y, 0.1f, 500.0f);
+    view_half_x = half_x;
+    view_half_y = half_y;
+}
+
+/* Centre of the view, the pan goes on top of where the camera follows the ball to */
+float camera_x ()
+{
+    return follow_x - panx * (8.0f + 2*zoom) / 600;
 }
 
-VAO *bird1,*bird2,*bird3,*canon, *rectangle , *rectangle2 , *rectangle3 , *rectangle4 ,*rectangle5,*rectangle6,*coins[500];
-// VAO coins[] = malloc(num_coin*sizeof(VAO));
+float camera_y ()
+{
+    return follow_y - pany * (8.0f + 2*zoom) / 600;
+}
 
-int i=0;
-GLfloat vertex_buffer_data [500] ;
-GLfloat color_buffer_data [500] ;
-void add(GLdouble x,GLdouble y)
+/* Camera for 2D (ortho) in the XY plane, moved by the pan instead of the viewport */
+glm::mat4 camera_view ()
 {
-    vertex_buffer_data[i]=x;
-    color_buffer_data[i++]=0.184314  ;
-    vertex_buffer_data[i]=y;
-    color_buffer_data[i++]=0.309804;
-    vertex_buffer_data[i]=0;
-    color_buffer_data[i++]=0.3098040;
+    float x = camera_x(), y = camera_y();
+    return glm::lookAt(glm::vec3(x,y,3), glm::vec3(x,y,0), glm::vec3(0,1,0));
+}
+
+/* Dynamic resolution - the world is drawn into an offscreen target whose size follows
+   the GPU frame time, then stretched over the window. The HUD is drawn at full resolution */
+#define MIN_RESOLUTION_SCALE 0.25f
+struct DynamicResolution {
+    GLuint framebuffer;
+    GLuint color;
+    GLuint depth;
+    int width, height;      // size of the offscreen target, 0 when drawing straight to the window
+    float scale;
+    float budget_ms;        // GPU frame time to stay under
+    double cost_ms;         // smoothed GPU frame time
+    long resizes;
+};
+typedef struct DynamicResolution DynamicResolution;
+
+DynamicResolution dyn_res = { 0, 0, 0, 0, 0, 1.0f, 16.6f, 0, 0 };
 
+void destroy_resolution_target ()
+{
+    if(dyn_res.framebuffer)
+    {
+        glDeleteFramebuffers(1, &dyn_res.framebuffer);
+        glDeleteRenderbuffers(1, &dyn_res.color);
+        glDeleteRenderbuffers(1, &dyn_res.depth);
+    }
+    dyn_res.framebuffer = dyn_res.color = dyn_res.depth = 0;
+    dyn_res.width = dyn_res.height = 0;
 }
 
-void add_coins(GLdouble x,GLdouble y)
+/* Size of the target for the current scale, in steps of 8 pixels so it is not rebuilt every frame */
+void target_size (int& width, int& height)
 {
-    vertex_buffer_data[i]=x;
-    color_buffer_data[i++]= 0.8  ;
-    vertex_buffer_data[i]=y;
-    color_buffer_data[i++]=0.498039;
-    vertex_buffer_data[i]=0;
-    color_buffer_data[i++]=0.196078;
+    width = max(8, ((int)(window_width*dyn_res.scale) + 4) / 8 * 8);
+    height = max(8, ((int)(window_height*dyn_res.scale) + 4) / 8 * 8);
+}
 
+/* Binds where the world is drawn this frame */
+void begin_scene_pass ()
+{
+    int width, height;
+    target_size(width, height);
+    if(width >= window_width && height >= window_height)
+    {
+        destroy_resolution_target();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, window_width, window_height);
+        return;
+    }
+    if(width != dyn_res.width || height != dyn_res.height)
+    {
+        destroy_resolution_target();
+        glGenFramebuffers(1, &dyn_res.framebuffer);
+        glGenRenderbuffers(1, &dyn_res.color);
+        glGenRenderbuffers(1, &dyn_res.depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, dyn_res.color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, dyn_res.depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, dyn_res.framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, dyn_res.color);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, dyn_res.depth);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            // no offscreen target on this driver, stay at full resolution
+            cout<<"Offscreen target incomplete, dynamic resolution disabled"<<endl;
+            destroy_resolution_target();
+            dyn_res.budget_ms = 0;
+            dyn_res.scale = 1;
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, window_width, window_height);
+            return;
+        }
+        dyn_res.width = width;
+        dyn_res.height = height;
+        dyn_res.resizes++;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, dyn_res.framebuffer);
+    glViewport(0, 0, dyn_res.width, dyn_res.height);
 }
 
-// Creates the triangle object used in this sample code
-void create_angry_bird (GLdouble centrex,GLdouble centrey)
+/* Stretches the offscreen target over the window, what follows is drawn at full resolution */
+void end_scene_pass ()
 {
-  /* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
+    if(dyn_res.framebuffer == 0)
+        return;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, dyn_res.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, dyn_res.width, dyn_res.height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, window_width, window_height);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+/* Moves the resolution scale towards a GPU frame time just under the budget. Only the GPU
+   work shrinks with the resolution, a frame held up by the CPU is left alone */
+void update_resolution_scale (double gpu_ms)
+{
+    if(dyn_res.budget_ms <= 0 || !gpu_timers.supported)
+        return;
+    dyn_res.cost_ms = dyn_res.cost_ms == 0 ? gpu_ms : dyn_res.cost_ms*0.9 + gpu_ms*0.1;
+    if(dyn_res.cost_ms > dyn_res.budget_ms)
+        dyn_res.scale = max(MIN_RESOLUTION_SCALE, dyn_res.scale*0.95f);
+    else if(dyn_res.cost_ms < dyn_res.budget_ms*0.7)
+        dyn_res.scale = min(1.0f, dyn_res.scale*1.02f);
+}
+
+/* GPU particles - every particle lives in one of two buffers and is advanced by a vertex shader
+   whose output transform feedback writes into the other one, then the fresh buffer is drawn as
+   points. The CPU only hands out ranges of the particle ring to spawn records, so its cost
+   depends on the number of bursts, never on the number of live particles */
+#define PARTICLE_MAX_SPAWNS 16      // must match MAX_SPAWNS in Particles_update.vert
+#define PARTICLE_GROUND_Y (float)(level_blocks[LEVEL_GROUND].pivot_y + level_blocks[LEVEL_GROUND].y1)   // top of the ground
+
+enum ParticleKind { PARTICLE_COIN, PARTICLE_BOUNCE, PARTICLE_TRAP };
+
+struct ParticleSpawn {
+    float x, y;
+    float speed;
+    int kind;
+    int first;      // first slot in the particle ring
+    int count;
+};
+typedef struct ParticleSpawn ParticleSpawn;
+
+struct ParticleSystem {
+    bool supported;
+    int capacity;                   // particles in the ring, 0 disables the system
+    int cursor;                     // next slot handed to a spawn, the oldest particles are reused
+    int current;                    // buffer holding the latest state
+    GLBuffer buffers[2];
+    GLVertexArray arrays[2];
+    GLProgram update, render;
+    GLint spawn_count_id, spawn_origin_id, spawn_range_id, capacity_id, seed_id, dt_id, ground_id;
+    GLint vp_id, point_scale_id;
+    vector<ParticleSpawn> spawns;   // waiting for the next update
+    unsigned int frame;
+    long bursts;
+    long spawned;
+    long deferred;                  // spawn records pushed to a later frame by the per-frame limit
+    chrono::steady_clock::time_point last_update;
+};
+typedef struct ParticleSystem ParticleSystem;
+
+ParticleSystem particles;
+int particle_capacity = 131072;
+
+void init_particles ()
+{
+    particles.capacity = particle_capacity;
+    particles.supported = false;
+    if(particles.capacity <= 0)
+        return;
+
+    const char* varyings[] = { "out_state0", "out_state1" };
+    particles.update = GLProgram(LoadFeedbackShader("Particles_update.vert", varyings, 2));
+    particles.render = GLProgram(LoadShaders("Particles.vert", "Particles.frag"));
+    if(particles.update.id() == 0)
+    {
+        cout<<"Particles disabled, the update shader did not link"<<endl;
+        particles.render.reset();
+        return;
+    }
+
+    // zeroed state is dead, age 0 is not below lifetime 0
+    vector<GLfloat> zero(8*particles.capacity, 0.0f);
+    for(int b=0;b<2;b++)
+    {
+        GLuint array;
+        glGenVertexArrays(1, &array);
+        particles.arrays[b] = GLVertexArray(array);
+        glBindVertexArray(array);
+        particles.buffers[b] = GLBuffer(GL_ARRAY_BUFFER, zero.size()*sizeof(GLfloat), &zero[0]);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)0);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat), (void*)(4*sizeof(GLfloat)));
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+    }
+
+    GLuint update = particles.update.id(), render = particles.render.id();
+    particles.spawn_count_id = glGetUniformLocation(update, "spawn_count");
+    particles.spawn_origin_id = glGetUniformLocation(update, "spawn_origin");
+    particles.spawn_range_id = glGetUniformLocation(update, "spawn_range");
+    particles.capacity_id = glGetUniformLocation(update, "capacity");
+    particles.seed_id = glGetUniformLocation(update, "seed");
+    particles.dt_id = glGetUniformLocation(update, "dt");
+    particles.ground_id = glGetUniformLocation(update, "ground_y");
+    particles.vp_id = glGetUniformLocation(render, "VP");
+    particles.point_scale_id = glGetUniformLocation(render, "point_scale");
+    particles.current = 0;
+    particles.cursor = 0;
+    particles.last_update = chrono::steady_clock::now();
+    particles.supported = true;
+}
+
+void release_particles ()
+{
+    for(int b=0;b<2;b++)
+    {
+        particles.buffers[b].reset();
+        particles.arrays[b].reset();
+    }
+    particles.update.reset();
+    particles.render.reset();
+    particles.spawns.clear();
+    particles.supported = false;
+}
+
+/* Queues a burst of 'count' particles at (x,y), flying out at up to 'speed' units per second */
+void emit_particles (ParticleKind kind, float x, float y, int count, float speed)
+{
+    if(!particles.supported || count <= 0)
+        return;
+    count = min(count, particles.capacity);
+    ParticleSpawn spawn = { x, y, speed, kind, particles.cursor, count };
+    particles.cursor = (particles.cursor + count) % particles.capacity;
+    particles.spawns.push_back(spawn);
+    particles.bursts++;
+    particles.spawned += count;
+}
+
+/* Advances every particle by the wall time since the last update, one transform feedback pass */
+void update_particles ()
+{
+    if(!particles.supported)
+        return;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    float dt = min(0.05, chrono::duration<double>(now - particles.last_update).count());
+    particles.last_update = now;
+
+    int count = min((int)particles.spawns.size(), PARTICLE_MAX_SPAWNS);
+    GLfloat origin[4*PARTICLE_MAX_SPAWNS];
+    GLint range[2*PARTICLE_MAX_SPAWNS];
+    for(int s=0;s<count;s++)
+    {
+        const ParticleSpawn& spawn = particles.spawns[s];
+        origin[4*s] = spawn.x;
+        origin[4*s+1] = spawn.y;
+        origin[4*s+2] = spawn.speed;
+        origin[4*s+3] = spawn.kind;
+        range[2*s] = spawn.first;
+        range[2*s+1] = spawn.count;
+    }
+    particles.deferred += particles.spawns.size() - count;
+    particles.spawns.erase(particles.spawns.begin(), particles.spawns.begin() + count);
 
-    const double TWO_PI = 6.2831853;
-    GLdouble hexTheta,x,y,previousx,previousy;
-    // adds point to the vertex_buffer array
-
-    hexTheta = TWO_PI * 0/40;
-    x = centrex + radius_object * cos(hexTheta);
-    y = centrey + radius_object * sin(hexTheta);
-    add(centrex,centrey);
-    add(x,y);
-    hexTheta = TWO_PI * 1/20;
-    x = centrex + radius_object * cos(hexTheta);
-    y = centrey + radius_object * sin(hexTheta);
-    add(x,y);
-    previousy = y;
-    previousx = x;
-
-    int j;
-    // building many triangles to form one circle
-    for(j=2;j<=20;j++)
-    {
-        hexTheta = TWO_PI * j/20;
-        // defining the new vertices
-        x = centrex + radius_object * cos(hexTheta);
-        y = centrey + radius_object * sin(hexTheta);
-        // assigining vertices to new triangle
-        add(centrex,centrey);
-        add(previousx,previousy);
-        add(x,y);
-        previousy = y;
-        previousx = x;
+    glUseProgram(particles.update.id());
+    glUniform1i(particles.spawn_count_id, count);
+    if(count)
+    {
+        glUniform4fv(particles.spawn_origin_id, count, origin);
+        glUniform2iv(particles.spawn_range_id, count, range);
     }
+    glUniform1i(particles.capacity_id, particles.capacity);
+    glUniform1ui(particles.seed_id, particles.frame++);
+    glUniform1f(particles.dt_id, dt);
+    glUniform1f(particles.ground_id, PARTICLE_GROUND_Y);
+
+    int next = 1 - particles.current;
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(particles.arrays[particles.current].id());
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, particles.buffers[next].id());
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, particles.capacity);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    particles.current = next;
+}
+
+/* One draw for the whole pool, dead particles are clipped in the vertex shader */
+void draw_particles (const glm::mat4& VP)
+{
+    if(!particles.supported)
+        return;
+    int width, height;
+    target_size(width, height);
+
+    glUseProgram(particles.render.id());
+    glUniformMatrix4fv(particles.vp_id, 1, GL_FALSE, &VP[0][0]);
+    glUniform1f(particles.point_scale_id, min(width, height) / (2*(4.0f + zoom)));
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(particles.arrays[particles.current].id());
+    glDrawArrays(GL_POINTS, 0, particles.capacity);
+    glDepthMask(GL_TRUE);
+    glUseProgram(programID.id());
+}
+
+VAO *bird1,*bird2,*bird3,*canon,*canon_barrel, *rectangle , *rectangle2 , *rectangle3 , *rectangle4 ,*rectangle5,*rectangle6;
+AlignedArray<VAO*> coins;
+// coin VAOs are created on demand (see ensure_coin_vaos), GL ones all share one pair of VBOs
+VAOPool coin_pool = { vector<VAO*>(), vector<VAO*>(), 0, 0 };
+GLBuffer coin_vertex_buffer, coin_color_buffer, coin_shape_buffer;
+int coins_created = 0;
+
+// circle meshes, baked at compile time (radius_object, radius_coins and the canon muzzle)
+constexpr double canon_muzzle_x = 2, canon_muzzle_radius = 0.5;
+constexpr Mesh<CIRCLE_VERTICES> bird_quad = circle_quad_mesh(0.30, CIRCLE_QUAD_EXTENT);
+constexpr Mesh<CIRCLE_VERTICES> coin_quad = circle_quad_mesh(0.10, CIRCLE_QUAD_EXTENT);
+constexpr Mesh<CIRCLE_VERTICES> canon_quad = circle_quad_mesh(canon_muzzle_radius, CIRCLE_QUAD_EXTENT, canon_muzzle_x, 0);
+constexpr Mesh<4> canon_barrel_lines = tangent_lines_mesh(canon_muzzle_x, 0, canon_muzzle_radius);
+constexpr MeshColors<CIRCLE_VERTICES> bird_colors = solid_colors<CIRCLE_VERTICES>(0.184314, 0.309804, 0.309804);
+constexpr MeshColors<CIRCLE_VERTICES> coin_colors = solid_colors<CIRCLE_VERTICES>(0.8, 0.498039, 0.196078);
+constexpr MeshColors<4> barrel_colors = solid_colors<4>(0.184314, 0.309804, 0.309804);
+constexpr CircleShape coin_shape = circle_quad_shape(CIRCLE_QUAD_EXTENT, CIRCLE_OUTLINE, 10);
+
+// Creates the ball and the two wheels, one circle quad each
+void create_angry_bird ()
+{
+  /* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
+    constexpr CircleShape outline = circle_quad_shape(CIRCLE_QUAD_EXTENT, CIRCLE_OUTLINE, 20);
+    constexpr CircleShape disc = circle_quad_shape(CIRCLE_QUAD_EXTENT, CIRCLE_DISC, 0);
 
   // create3DObject creates and returns a handle to a VAO that can be used later
-  bird1 = create3DObject(GL_TRIANGLES, 180, vertex_buffer_data, color_buffer_data, GL_LINE); // moving_wheel
-  bird2 = create3DObject(GL_TRIANGLES, 180, vertex_buffer_data, color_buffer_data, GL_FILL); //canon's wheel
-  bird3 = create3DObject(GL_TRIANGLES, 180, vertex_buffer_data, color_buffer_data, GL_LINE); // angry_bird
-  i=0;
+  bird1 = create3DObject(GL_TRIANGLES, bird_quad, bird_colors, GL_FILL); // moving_wheel
+  attach_circle_shape(bird1, outline);
+  bird2 = create3DObject(GL_TRIANGLES, bird_quad, bird_colors, GL_FILL); //canon's wheel
+  attach_circle_shape(bird2, disc);
+  bird3 = create3DObject(GL_TRIANGLES, bird_quad, bird_colors, GL_FILL); // angry_bird
+  attach_circle_shape(bird3, outline);
 }
 
-void create_angry_coins (GLdouble centrex,GLdouble centrey)
+void create_angry_coins ()
 {
   /* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
+    // the coin geometry itself is made by the renderer along with the first coin
+    srand((unsigned)time(0));
+    // the deterministic mode places coins from its own seeded generator
+    if(deterministic_physics)
+        sim_reset(sim, sim_seed);
+}
 
-    const double TWO_PI = 6.2831853;
-    GLdouble hexTheta,x,y,previousx,previousy;
-    // adds point to the vertex_buffer array
-
-    hexTheta = TWO_PI * 0;
-    x = centrex + radius_coins * cos(hexTheta);
-    y = centrey + radius_coins * sin(hexTheta);
-    add_coins(centrex,centrey);
-    add_coins(x,y);
-    hexTheta = TWO_PI * 1/10;
-    x = centrex + radius_coins * cos(hexTheta);
-    y = centrey + radius_coins * sin(hexTheta);
-    add_coins(x,y);
-    previousy = y;
-    previousx = x;
-
-    int j;
-    // building many triangles to form one circle
-    for(j=2;j<=10;j++)
-    {
-        hexTheta = TWO_PI * j/10;
-        // defining the new vertices
-        x = centrex + radius_coins * cos(hexTheta);
-        y = centrey + radius_coins * sin(hexTheta);
-        // assigining vertices to new triangle
-        add_coins(centrex,centrey);
-        add_coins(previousx,previousy);
-        add_coins(x,y);
-        previousy = y;
-        previousx = x;
+/* GL back end of the coin VAOs, every coin has the same geometry so it is uploaded once
+   with the first coin and the VAOs share it */
+VAO* gl_create_coin_object ()
+{
+    if(coin_vertex_buffer.id() == 0)
+    {
+        coin_vertex_buffer = GLBuffer(GL_ARRAY_BUFFER, sizeof(coin_quad.positions), coin_quad.positions);
+        coin_color_buffer = GLBuffer(GL_ARRAY_BUFFER, sizeof(coin_colors.rgb), coin_colors.rgb);
+        coin_shape_buffer = GLBuffer(GL_ARRAY_BUFFER, sizeof(coin_shape.values), coin_shape.values);
     }
+    VAO* vao = pool_alloc_vao(coin_pool);
+    vao->VertexBuffer = coin_vertex_buffer.id();
+    vao->ColorBuffer = coin_color_buffer.id();
+    vao->ShapeBuffer = coin_shape_buffer.id();
+    vao->PrimitiveMode = GL_TRIANGLES;
+    vao->FillMode = GL_FILL;
+    vao->NumVertices = CIRCLE_VERTICES;
 
-    srand((unsigned)time(0));
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  for(int r=1;r<=490;r++)
+    glBindVertexArray (vao->VertexArrayID);
+    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    bind_circle_shape(vao->ShapeBuffer);
+    return vao;
+}
+
+/* Creates VAOs for coins up to 'count', only the coins in play get GPU resources */
+void ensure_coin_vaos (int count)
+{
+    for(int r=coins_created+1;r<=count;r++)
+        coins[r] = renderer->create_coin_object();
+    if(count > coins_created)
+        coins_created = count;
+}
+
+/* Bytes held by the per-coin arrays and the grid over them */
+size_t coin_storage_bytes ()
+{
+    return centerx_coin.bytes() + centery_coin.bytes() + flag_coin.bytes() + coins.bytes() + coin_grid.bytes();
+}
+
+/* Grows the per-coin arrays to hold coins 1..count, places the new coins and gives them VAOs.
+   Deterministic mode takes the positions from the fixed-point sim, which has max_coins of them */
+void ensure_coins (int count)
+{
+    int first = max(1, (int)flag_coin.size());
+    if(count >= first)
+    {
+        centerx_coin.resize(count+1);
+        centery_coin.resize(count+1);
+        flag_coin.resize(count+1);
+        coins.resize(count+1);
+    }
+    for(int r=first;r<=count;r++)
     {
-        coins[r]= create3DObject(GL_TRIANGLES, 30, vertex_buffer_data, color_buffer_data, GL_LINE);
         flag_coin[r] = true ;
-        coins_rot_dir[r] = -1;
-        coins_rotation[r] = 0;
-        coins_rot_status[r] = true;
+        if(deterministic_physics)
+        {
+            flag_coin[r] = r <= max_coins && sim.coin_alive[r];
+            if(r <= max_coins)
+            {
+                centerx_coin[r] = fx_to_double(sim.coin_x[r]);
+                centery_coin[r] = fx_to_double(sim.coin_y[r]);
+                coin_grid.insert(r, centerx_coin[r], centery_coin[r]);
+            }
+            continue;
+        }
         double temp1 = (rand()%78 -39);
             temp1/= 10;
         double temp2 = (rand()%60 -30);
             temp2/= 10;
         centerx_coin[r] =  temp1;
-        // cout<<centerx_coin[r]<<endl;
         centery_coin[r] = temp2;
+        coin_grid.insert(r, centerx_coin[r], centery_coin[r]);
     }
-  i=0;
+    ensure_coin_vaos(count);
 }
 
 
-// creates canon
-void createcanon (GLdouble centrex,GLdouble centrey)
+// creates canon: the muzzle circle and the two lines from the pivot tangent to it
+void createcanon ()
 {
   /* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
-    const double TWO_PI = 6.2831853;
-    GLdouble hexTheta,x,y,radius_canon=.50,previousx,previousy;
-    // adds point to the vertex_buffer array
-
-    hexTheta = TWO_PI * 0/20;
-    x = centrex + radius_canon * cos(hexTheta);
-    y = centrey + radius_canon * sin(hexTheta);
-    add(0,0);
-    add(x,y);
-    hexTheta = TWO_PI * 1/20;
-    x = centrex + radius_canon * cos(hexTheta);
-    y = centrey + radius_canon * sin(hexTheta);
-    add(x,y);
-    previousy = y;
-    previousx = x;
-
-    int j;
-    // building many triangles to form one circle
-    for(j=2;j<=20;j++)
-    {
-        hexTheta = TWO_PI * j/20;
-        // defining the new vertices
-        x = centrex + radius_canon * cos(hexTheta);
-        y = centrey + radius_canon * sin(hexTheta);
-        // assigining vertices to new triangle
-        add(0,0);
-        add(previousx,previousy);
-        add(x,y);
-        previousy = y;
-        previousx = x;
-    }
-
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  canon = create3DObject(GL_TRIANGLES, 180, vertex_buffer_data, color_buffer_data, GL_LINE);
-  i=0;
+    constexpr CircleShape shape = circle_quad_shape(CIRCLE_QUAD_EXTENT, CIRCLE_OUTLINE, 0);
+  canon = create3DObject(GL_TRIANGLES, canon_quad, bird_colors, GL_FILL);
+  attach_circle_shape(canon, shape);
+  canon_barrel = create3DObject(GL_LINES, canon_barrel_lines, barrel_colors, GL_FILL);
 }
 
 void createRectangle ()
@@ -668,13 +2061,15 @@ void water_rectangle(){
 }
 
 void ground_rectangle(){
+    // the ground collider is this mesh
+    const LevelBlock& g = level_blocks[LEVEL_GROUND];
     const GLfloat vertex_buffer_data [] = {
-      -180,-10,0,
-      -180,0.2f,0,
-      170,-10,0,
-      170,-10,0,
-      170,0.2f,0,
-      -180,0.2f,0,
+      (GLfloat)g.x0,(GLfloat)g.y0,0,
+      (GLfloat)g.x0,(GLfloat)g.y1,0,
+      (GLfloat)g.x1,(GLfloat)g.y0,0,
+      (GLfloat)g.x1,(GLfloat)g.y0,0,
+      (GLfloat)g.x1,(GLfloat)g.y1,0,
+      (GLfloat)g.x0,(GLfloat)g.y1,0,
     };
 
     static const GLfloat color_buffer_data [] = {
@@ -745,31 +2140,38 @@ void accelaration_func(){
 
 }
 
-void friction_coefficient(){
-    if((collisiony + newy ) < 0.005f) // ground
-            {
-                ex = 1.2f ;
-                ey = 1.5f ;
-            }
-        // left-most rectangle
-    else if(((collisiony + newy -3) >= (1.95f-radius_object ) && (collisiony + newy -3) <= (2.21f+radius_object )) && (collisionx + newx -3) >= -1.7f && (collisionx + newx -3) <= -0.50f)
-            {
-                ex = 1.2f;
-                ey =1.2f ;
-            }
-        // right-most rectangle
-    else if(((collisiony + newy -3) >= (1.95f-radius_object ) && (collisiony + newy -3) <= (2.21f+radius_object )) && (collisionx + newx -3) >= 2.4f && (collisionx + newx -3) <= 3.6f)
-            {
-                ex = 1.2f;
-                ey = 1.2f ;
-            }
-        // rough-ground rectangle
-    else if(((collisiony + newy -3) >= (-3.25f-radius_object ) && (collisiony + newy -3) <= (-2.99f+radius_object )) && (collisionx + newx -3) >= 0.7f && (collisionx + newx -3) <= 1.9f)
-        {
-            ex = 3.0f;
-            ey = 2.1f;
-        }
+/* Blocks the ball collides with, level_blocks in game_sim.h and then the trap. Solid ones
+   carry the friction the surfaces always had, the trappy box is a hazard */
+enum ObstacleIndex { OBSTACLE_LEFT = LEVEL_LEFT, OBSTACLE_RIGHT = LEVEL_RIGHT, OBSTACLE_ROUGH = LEVEL_ROUGH,
+                     OBSTACLE_GROUND = LEVEL_GROUND, OBSTACLE_TRAP = NUM_LEVEL_BLOCKS, NUM_OBSTACLES };
+ObstacleSet obstacles;
+vector<CircleContact> contacts;
+
+void init_obstacles(){
+    for(int b=0;b<NUM_LEVEL_BLOCKS;b++)
+        obstacle_add(obstacles, OBSTACLE_SOLID, level_blocks[b].ex, level_blocks[b].ey);
+    obstacle_add(obstacles, OBSTACLE_HAZARD, level_trap.ex, level_trap.ey);
+}
 
+/* Angular velocity of a block turning 'increments' degrees per frame, one frame is 0.01 of physics time */
+double block_spin(float rot_dir, bool rot_status){
+    return rot_dir*rot_status*M_PI/180.0f/0.01;
+}
+
+/* Puts obstacle 'o' where 'block' is drawn, its pivot raised by 'lift' and turned 'rotation' degrees */
+void place_block(int o, const LevelBlock& block, double lift, float rotation, double vy, double spin){
+    obstacle_place(obstacles, o, block.pivot_x, block.pivot_y + lift, rotation*M_PI/180.0f,
+                   block.x0, block.y0, block.x1, block.y1, 0, vy, spin);
+}
+
+/* Moves the obstacles to where draw() puts the blocks this tick */
+void update_obstacles(){
+    place_block(OBSTACLE_LEFT, level_blocks[LEVEL_LEFT], 0, rectangle_rotation, 0, block_spin(rectangle_rot_dir, rectangle_rot_status));
+    place_block(OBSTACLE_RIGHT, level_blocks[LEVEL_RIGHT], 0, rectangle2_rotation, 0, block_spin(rectangle2_rot_dir, rectangle2_rot_status));
+    place_block(OBSTACLE_ROUGH, level_blocks[LEVEL_ROUGH], 0, rectangle3_rotation, 0, block_spin(rectangle3_rot_dir, rectangle3_rot_status));
+    place_block(OBSTACLE_GROUND, level_blocks[LEVEL_GROUND], 0, rectangle5_rotation, 0, block_spin(rectangle5_rot_dir, rectangle5_rot_status));
+    // 'dir' is the velocity of the trap
+    place_block(OBSTACLE_TRAP, level_trap, trappy, rectangle4_rotation, dir, block_spin(rectangle4_rot_dir, rectangle4_rot_status));
 }
 
 void move_func(){
@@ -785,215 +2187,991 @@ void move_func(){
 
 }
 
-void collect_coins(){
+/****************************************
+ * Jobs                                 *
+ ****************************************/
+/* The per-coin passes of a frame are split into chunks of COIN_JOB_GRAIN coins and run on
+   every core through the job system, a level small enough for one chunk stays on this thread */
+#define COIN_JOB_GRAIN 4096
 
-    double dist=0,x,y;
-    x= collisionx+newx-3;
-    y= collisiony+newy-3;
-    for(int r=1;r<=num_coin;r++)
+JobSystem* jobs = NULL;
+int job_threads = 0;        // 0 uses every core
+JobGraph frame_graph;
+vector<int> coin_chunk_drawn, coin_chunk_culled;
+
+/* VP * translate(x,y), only the last column changes. The spin is coin_animation's */
+glm::mat4 coin_MVP (const glm::mat4& VP, float x, float y)
+{
+    glm::mat4 MVP = VP;
+    MVP[3] = VP[0]*x + VP[1]*y + VP[3];
+    return MVP;
+}
+
+int coin_chunks ()
+{
+    return (num_coin + COIN_JOB_GRAIN-1) / COIN_JOB_GRAIN;
+}
+
+/* Queues every coin in view. Each chunk writes its coins to its own stretch of the queue,
+   the stretches are closed up once all chunks are done */
+void queue_coins (RenderQueue& queue, const glm::mat4& VP)
+{
+    if(queue.capacity - queue.count < num_coin)
     {
-    dist = calc_dist(x,centerx_coin[r],y,centery_coin[r]);
-    if(dist<=(radius_coins+radius_object) && flag_coin[r]==true)
+        // the arena could not hold the pass, draw coin by coin
+        for(int r=1;r<=num_coin;r++)
+            if(flag_coin[r] && visible_circle(centerx_coin[r], centery_coin[r], radius_coins))
+                queue_draw(queue, GROUP_COINS, 0, coins[r], coin_MVP(VP, centerx_coin[r], centery_coin[r]), coin_animation);
+        return;
+    }
+
+    int base = queue.count;
+    RenderCommand* out = queue.commands + base;
+    coin_chunk_drawn.resize(coin_chunks());
+    coin_chunk_culled.resize(coin_chunks());
+    auto chunk_pass = [&](int first, int last) {
+        int chunk = (first-1) / COIN_JOB_GRAIN;
+        TraceZone zone("coin chunk");
+        RenderCommand* dst = out + (first-1);
+        int drawn = 0, culled = 0;
+        for(int r=first;r<last;r++)
         {
-            score++;
-            cout<<"Your current Score is "<<score<<endl;
-            if((score%num_coin)==0 && score!=0)
+            // collected coins are neither drawn nor counted by the culling
+            if(flag_coin[r])
+            {
+                if(in_view_circle(centerx_coin[r], centery_coin[r], radius_coins))
                 {
-                    num_coin +=12;
-                    level++;
-                    cout<<"Hurray , You are now one level up!! "<<endl;
-                    cout<<"Current level is "<<level<<endl;
+                    glm::mat4 MVP = coin_MVP(VP, centerx_coin[r], centery_coin[r]);
+                    dst[drawn++] = render_command(GROUP_COINS, 0, coins[r], MVP, base + r-1, coin_animation);
                 }
-                if(num_coin > 499)
-                    exit_func();
-            flag_coin[r]=false;
-            break;
+                else
+                    culled++;
+            }
         }
+        coin_chunk_drawn[chunk] = drawn;
+        coin_chunk_culled[chunk] = culled;
+    };
+    if(num_coin <= COIN_JOB_GRAIN)
+        chunk_pass(1, num_coin+1);
+    else
+    {
+        frame_graph.clear();
+        frame_graph.parallel_for(1, num_coin+1, COIN_JOB_GRAIN, chunk_pass);
+        jobs->run(frame_graph);
     }
-    // cout<<num_coin<<endl;
 
+    for(int c=0;c<coin_chunks();c++)
+    {
+        if(queue.commands + queue.count != out + c*COIN_JOB_GRAIN)
+            memmove(queue.commands + queue.count, out + c*COIN_JOB_GRAIN, coin_chunk_drawn[c]*sizeof(RenderCommand));
+        queue.count += coin_chunk_drawn[c];
+        cull_stats.visible += coin_chunk_drawn[c];
+        cull_stats.culled += coin_chunk_culled[c];
+    }
+    render_stats.commands += queue.count - base;
 }
 
-void collision_func(){
-
-    if(shoot == false)
-    return ;
+/****************************************
+ * World streaming                      *
+ ****************************************/
+/* --world N lays N chunks of WORLD_CHUNK_WIDTH units right of the level, each with its own
+   coins and blocks, and its own ground once the level's runs out. The chunks near the ball
+   and the view are kept within --world-budget KB, see world_chunks.h. A resident chunk is
+   one draw for all its boxes and the ball only tests the chunks it is over. World coins are
+   counted on their own, the level's coins still decide the level */
+#define WORLD_ORIGIN_X 5.0f
+#define WORLD_CHUNK_WIDTH 8.0f
+#define WORLD_CHUNK_COINS 24
+#define WORLD_CHUNK_BLOCKS 6
+#define WORLD_BUDGET_KB 256
+#define CAMERA_FOLLOW_RATE 4.0  // per second, the camera closes 1-e^-rate*t of the gap in t seconds
+#define FALL_LIMIT_Y -20        // a ball below this has fallen off the world
+
+int world_chunks = 0;
+size_t world_budget = WORLD_BUDGET_KB*1024;
+VAO* world_coin = NULL;     // the shared coin geometry every world coin is drawn with
+vector<WorldChunk*> near_chunks;
+vector<ObstacleSet*> collision_sets;
+double camera_time = 0;
+
+void load_world_chunk (WorldChunk& chunk)
+{
+    chunk.mesh = create3DObject(GL_TRIANGLES, chunk.vertices, &chunk.positions[0], &chunk.colors[0], GL_FILL);
+}
 
-  // radius_object = radius_object of angryobject
-  //   collision in x-plane
-    if((collisiony + newy ) < 0.005f // ground
-        ||
-        // left-most rectangle
-        (((collisiony + newy -3) >= (1.95f-radius_object ) && (collisiony + newy -3) <= (2.21f+radius_object )) && (collisionx + newx -3) >= (-1.7f-radius_object+0.08) && (collisionx + newx -3) <= (-0.50f+radius_object-0.08))
-        ||
-        // right-most rectangle
-        (((collisiony + newy -3) >= (1.95f-radius_object ) && (collisiony + newy -3) <= (2.21f+radius_object )) && (collisionx + newx -3) >= (2.4f-radius_object+0.08) && (collisionx + newx -3) <= (3.6f+radius_object-0.08))
-        ||
-        // rough-ground rectangle
-        (((collisiony + newy -3) >= (-3.25f-radius_object ) && (collisiony + newy -3) <= (-2.99f+radius_object )) && (collisionx + newx -3) >= 0.7f && (collisionx + newx -3) <= 1.9f)
-
-      )
-    {
-        uy = vy;
-        ux = vx ;
-        // collision effect
-        uy *= -1 ;
-        ux /=ex;
-        uy /=ey;
-        // saved current co-ordinates
-        collisionx +=newx;
-        collisiony += newy;
-        o=0; // time initialised to zero , new projectile started
-    }
+void evict_world_chunk (WorldChunk& chunk)
+{
+    renderer->release_object((VAO*)chunk.mesh);
+}
 
-    // collision at y-plane
-    else if( // rough-ground rectangle
-        (((collisiony + newy -3) >= (-3.25f-radius_object ) && (collisiony + newy -3) <= (-2.99f+radius_object )) && (collisionx + newx -3) >= 0.7f-radius_object && (collisionx + newx -3) <= 0.7f)
+void init_world ()
+{
+    if(world_chunks <= 0)
+        return;
+    WorldLayout layout;
+    layout.seed = sim_seed;
+    layout.origin_x = WORLD_ORIGIN_X;
+    layout.chunk_width = WORLD_CHUNK_WIDTH;
+    layout.chunks = world_chunks;
+    layout.coins = WORLD_CHUNK_COINS;
+    layout.blocks = WORLD_CHUNK_BLOCKS;
+    layout.min_y = -2.5;
+    layout.max_y = 3;
+    // the level's blocks, and its ground carried on
+    const LevelBlock& block = level_blocks[LEVEL_LEFT];
+    const LevelBlock& ground = level_blocks[LEVEL_GROUND];
+    layout.block_w = block.x1 - block.x0;
+    layout.block_h = block.y1 - block.y0;
+    layout.ground_from = ground.pivot_x + ground.x1;
+    layout.ground_bottom = ground.pivot_y + ground.y0;
+    layout.ground_top = ground.pivot_y + ground.y1;
+    WorldSurface block_surface = { (float)block.ex, (float)block.ey, { 0.847059, 0.847059, 0.74902 } };
+    WorldSurface ground_surface = { (float)ground.ex, (float)ground.ey, { 0.22, 0.69, 0.87 } };
+    layout.surfaces[WORLD_BLOCK] = block_surface;
+    layout.surfaces[WORLD_GROUND] = ground_surface;
+    world.configure(layout, world_budget, load_world_chunk, evict_world_chunk);
+    world_coin = renderer->create_coin_object();
+    camera_follow = true;
+}
 
-      )
+/* Eases the camera towards the ball, framing it where the canon sits at the start. Upwards
+   it only follows once the ball is within a unit of the top of the view */
+void update_camera ()
+{
+    double dt = min(max(frame_time - camera_time, 0.0), 0.1);
+    camera_time = frame_time;
+    double target_x = 0, target_y = 0;
+    if(camera_follow)
     {
-        uy = vy;
-        ux = vx ;
-        // collision effect
-        ux *= -1 ;
-        ux /=ex;
-        uy /=ey;
-        // saved current co-ordinates
-        collisionx +=newx;
-        collisiony += newy;
-        o=0; // time initialised to zero , new projectile started
+        target_x = collisionx + newx;
+        target_y = max(0.0, -3 + collisiony + newy - (view_half_y - 1));
     }
+    double t = 1 - exp(-CAMERA_FOLLOW_RATE*dt);
+    follow_x += (target_x - follow_x)*t;
+    follow_y += (target_y - follow_y)*t;
+}
 
-    int temp=0;
-
-    //   condition of stopping the ball
-      if(vx < 0.01 && vx > -0.01f){
-          temp++;
-      }
-      if(vy < 0.01 && vy > -0.01f){
-          temp++;
-      }
-
-  //   condition of initalising the shooting control
-      if(temp==2 ){
-          shoot=false;
-      }
+/* Streams the world around the ball and the part of it in view */
+void stream_world ()
+{
+    if(!world.active())
+        return;
+    float ball_x = -3 + collisionx + newx;
+    world.stream(min(ball_x - (float)radius_object, camera_x() - view_half_x),
+                 max(ball_x + (float)radius_object, camera_x() + view_half_x));
 }
 
-void trapping_box(){
-    if(trappy>0.5 || trappy<-2.5)
-        dir*=-1;
-    trappy+=0.01*dir;
-    // trappy*=dir;
-    double object_x = -3+collisionx+newx;
-    double object_y = -3 + collisiony + newy ;
-    double dist =0 ;
-    double trappy_x= 0.6+2;
-    double trappy_y = 0.5+trappy;
-    dist = calc_dist(object_x,trappy_x,object_y,trappy_y);
-    if(dist< 0.5+radius_object)
-        {
-            cout<<"Oops , you got fired by the trappy box."<<endl;
-            exit_func();
-        }
+/* Draws a resident chunk needs at most */
+int world_draws ()
+{
+    return world.resident().size()*(1 + WORLD_CHUNK_COINS);
+}
 
+/* Queues the resident chunks in view and their coins */
+void queue_world (RenderQueue& queue, const glm::mat4& VP)
+{
+    const vector<WorldChunk*>& chunks = world.resident();
+    for(size_t c=0;c<chunks.size();c++)
+    {
+        const WorldChunk& chunk = *chunks[c];
+        if(!visible_box(chunk.min_x - radius_coins, chunk.min_y - radius_coins,
+                        chunk.max_x + radius_coins, chunk.max_y + radius_coins))
+            continue;
+        queue_draw(queue, GROUP_WORLD, 0, (VAO*)chunk.mesh, VP);
+        for(int k=0;k<(int)chunk.coin_x.size();k++)
+            if(((chunk.alive >> k) & 1) && visible_circle(chunk.coin_x[k], chunk.coin_y[k], radius_coins))
+                queue_draw(queue, GROUP_COINS, 0, world_coin, coin_MVP(VP, chunk.coin_x[k], chunk.coin_y[k]), coin_animation);
+    }
 }
 
-void RenderString(float x, float y, void *font , string str, float r, float g, float b)
+void collect_world_coin (WorldChunk& chunk, int k)
 {
-	char *c;
-	glColor3f(r, g, b);
-	glShadeModel(GL_SMOOTH);
-	glRasterPos2f(x, y);
-  	for(string::iterator it = str.begin(); it!=str.end();it++)
-	{
-		glutBitmapCharacter(font, *it);
-	}
+    world.collect(chunk, k);
+    current_shot.coins++;
+    emit_particles(PARTICLE_COIN, chunk.coin_x[k], chunk.coin_y[k], 2000, 3);
+    cout<<"World coins collected: "<<world.collected()<<endl;
 }
 
-void draw ()
+void print_world_stats ()
 {
-  // clear the color and depth in the frame buffer
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if(!world.active())
+        return;
+    printf("World: %d of %d chunks resident, %zu of %zu bytes (peak %zu), %ld loads, %ld evictions (%ld for the budget), "
+           "%ld frames over budget, %ld coins collected\n", (int)world.resident().size(), world.layout().chunks,
+           world.bytes(), world.budget(), world.peak_bytes(), world.loads(), world.evictions(), world.budget_evictions(),
+           world.over_budget(), world.collected());
+}
 
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
+/* A coin the ball touched during a tick, 't' is how far through the step it first did */
+struct CoinHit {
+    float t;
+    int coin;               // level coin, 0 for a world coin
+    WorldChunk* chunk;      // or coin 'k' of this chunk
+    int k;
+};
+typedef struct CoinHit CoinHit;
 
-  // Eye - Location of camera. Don't change unless you are sure!!
-  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-  // Target - Where is the camera looking at.  Don't change unless you are sure!!
-  glm::vec3 target (0, 0, 0);
-  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-  glm::vec3 up (0, 1, 0);
+vector<CoinHit> coin_hits;
+
+/* Every coin in play the ball touched moving from (x0,y0) to (x1,y1), in the order it touched
+   them. The level's coins come from coin_grid, a world chunk's few coins are all tested */
+void sweep_coins (double x0, double y0, double x1, double y1, vector<CoinHit>& hits)
+{
+    hits.clear();
+    float reach = radius_coins + radius_object;
+    float dx = x1 - x0, dy = y1 - y0;
+    float minx = min(x0, x1) - reach, maxx = max(x0, x1) + reach;
+    float miny = min(y0, y1) - reach, maxy = max(y0, y1) + reach;
+    coin_grid.query(minx, miny, maxx, maxy, [&](int r) {
+        float t;
+        if(r <= num_coin && flag_coin[r] && sweep_circle_point(x0, y0, dx, dy, centerx_coin[r], centery_coin[r], reach, t))
+        {
+            CoinHit hit = { t, r, NULL, 0 };
+            hits.push_back(hit);
+        }
+    });
+    world.chunks_in(minx, maxx, near_chunks);
+    for(size_t c=0;c<near_chunks.size();c++)
+    {
+        WorldChunk& chunk = *near_chunks[c];
+        float t;
+        for(int k=0;k<(int)chunk.coin_x.size();k++)
+            if(((chunk.alive >> k) & 1) && sweep_circle_point(x0, y0, dx, dy, chunk.coin_x[k], chunk.coin_y[k], reach, t))
+            {
+                CoinHit hit = { t, 0, &chunk, k };
+                hits.push_back(hit);
+            }
+    }
+    // the grid hands coins out by cell, ties go to the lower numbered coin as they always did
+    sort(hits.begin(), hits.end(), [](const CoinHit& a, const CoinHit& b) {
+        return a.t != b.t ? a.t < b.t : a.coin != b.coin ? a.coin < b.coin : a.k < b.k;
+    });
+}
+
+void collect_coins(){
+
+    TraceZone zone("collect coins");
+    double x,y;
+    x= collisionx+newx-3;
+    y= collisiony+newy-3;
+    // everything crossed since the last tick, a coin a fast ball flies past included
+    if(!sweep_valid)
+    {
+        sweep_x = x;
+        sweep_y = y;
+        sweep_valid = true;
+    }
+    sweep_coins(sweep_x, sweep_y, x, y, coin_hits);
+    sweep_x = x;
+    sweep_y = y;
+    for(size_t h=0;h<coin_hits.size();h++)
+    {
+        if(coin_hits[h].chunk)
+        {
+            collect_world_coin(*coin_hits[h].chunk, coin_hits[h].k);
+            continue;
+        }
+        int r = coin_hits[h].coin;
+        score++;
+        current_shot.coins++;
+        emit_particles(PARTICLE_COIN, centerx_coin[r], centery_coin[r], 2000, 3);
+        cout<<"Your current Score is "<<score<<endl;
+        if((score%num_coin)==0 && score!=0)
+            {
+                TraceZone level_zone("level up");
+                num_coin +=12;
+                ensure_coins(num_coin);
+                level++;
+                cout<<"Hurray , You are now one level up!! "<<endl;
+                cout<<"Current level is "<<level<<endl;
+            }
+        flag_coin[r]=false;
+    }
+    // cout<<num_coin<<endl;
+
+}
+
+/* Dust where the ball hits, scaled by its speed, resting contact makes none */
+void bounce_particles(){
+    if(energy > 1)
+        emit_particles(PARTICLE_BOUNCE, -3+collisionx+newx, -3+collisiony+newy, (int)(energy*150), energy*0.3);
+}
+
+void collision_func(){
+
+    if(shoot == false)
+    return ;
+
+    TraceZone zone("collision");
+    double x = -3 + collisionx + newx;
+    double y = -3 + collisiony + newy;
+    if(y < FALL_LIMIT_Y)
+    {
+        journal_shot_end(SHOT_LOST);
+        return_ball();
+        return;
+    }
+    float velx = vx, vely = vy;
+    // slower than two ticks of gravity off a surface and the ball settles on it instead of bouncing
+    float rest_speed = -2*gravity*0.01;
+    double pushx = 0, pushy = 0;
+    bool touched = false, bounced = false;
+
+    // the level's blocks and those of the world chunks under the ball
+    collision_sets.assign(1, &obstacles);
+    world.chunks_in(x - radius_object, x + radius_object, near_chunks);
+    for(size_t c=0;c<near_chunks.size();c++)
+        collision_sets.push_back(&near_chunks[c]->colliders);
+    for(size_t s=0;s<collision_sets.size();s++)
+    {
+        ObstacleSet& set = *collision_sets[s];
+        if(collide_circle(set, x, y, radius_object, OBSTACLE_SOLID, contacts))
+            touched = true;
+        for(size_t c=0;c<contacts.size();c++)
+        {
+            // push out of every block, bounce off the ones the ball moves into
+            const CircleContact& contact = contacts[c];
+            pushx += contact.nx*contact.depth;
+            pushy += contact.ny*contact.depth;
+            if(contact_response(set, contact, velx, vely, rest_speed))
+            {
+                ex = set.ex[contact.obstacle];
+                ey = set.ey[contact.obstacle];
+                // a settling contact leaves the ball on the surface, only a rebound counts as a bounce
+                float sx, sy;
+                obstacle_surface_velocity(set, contact, sx, sy);
+                if((velx - sx)*contact.nx + (vely - sy)*contact.ny > 0)
+                    bounced = true;
+            }
+        }
+    }
+    if(touched)
+    {
+        if(bounced)
+        {
+            bounce_particles();
+            current_shot.bounces++;
+        }
+        ux = vx = velx;
+        uy = vy = vely;
+        // saved current co-ordinates
+        collisionx += newx + pushx;
+        collisiony += newy + pushy;
+        newx = newy = 0;
+        o=0; // time initialised to zero , new projectile started
+    }
+
+    int temp=0;
+
+    //   condition of stopping the ball
+      if(vx < 0.01 && vx > -0.01f){
+          temp++;
+      }
+      if(vy < 0.01 && vy > -0.01f){
+          temp++;
+      }
+
+  //   condition of initalising the shooting control
+      if(temp==2 ){
+          shoot=false;
+          journal_shot_end(SHOT_RESTED);
+      }
+}
+
+/* Set once the ball got trapped, the game exits at game_over_at so the burst can play out */
+bool game_over = false;
+chrono::steady_clock::time_point game_over_at;
+
+void trap_death(){
+    journal_shot_end(SHOT_TRAPPED);
+    if(autoplay_active())
+    {
+        // stress and headless runs carry on with the next shot, from where the last one started
+        return_ball();
+        return;
+    }
+    cout<<"Oops , you got fired by the trappy box."<<endl;
+    if(!particles.supported)
+        exit_func();
+    emit_particles(PARTICLE_TRAP, -3+collisionx+newx, -3+collisiony+newy, 20000, 6);
+    shoot = false;
+    game_over = true;
+    game_over_at = chrono::steady_clock::now() + chrono::milliseconds(1500);
+}
+
+/* The trap follows trap_animation on the tick clock, the same path the vertex shader draws
+   it on, so it keeps pace with the ball at any frame rate and an undo puts it back too.
+   'dir' becomes its velocity over the tick, one tick being 0.01 of physics time */
+void trapping_box(){
+    double previous = TRAP_LOW + animation_offset(trap_animation, (double)game_tick/ANIMATION_FRAME_RATE).y;
+    trappy = TRAP_LOW + animation_offset(trap_animation, (double)(game_tick+1)/ANIMATION_FRAME_RATE).y;
+    dir = (trappy - previous)/0.01;
+    update_obstacles();
+    // trappy*=dir;
+    double object_x = -3+collisionx+newx;
+    double object_y = -3 + collisiony + newy ;
+    if(collide_circle(obstacles, object_x, object_y, radius_object, OBSTACLE_HAZARD, contacts))
+        trap_death();
+
+}
+
+/* Copies the fixed-point simulation into the globals used for drawing */
+void mirror_sim(){
+    shoot = sim.shoot;
+    o = fx_to_double(sim.o);
+    ux = fx_to_double(sim.ux);
+    uy = fx_to_double(sim.uy);
+    vx = fx_to_double(sim.vx);
+    vy = fx_to_double(sim.vy);
+    newx = fx_to_double(sim.newx);
+    newy = fx_to_double(sim.newy);
+    collisionx = fx_to_double(sim.collisionx);
+    collisiony = fx_to_double(sim.collisiony);
+    energy = fx_to_double(sim.energy);
+    trappy = fx_to_double(sim.trappy);
+    score = sim.score;
+    level = sim.level;
+    num_coin = sim.num_coin;
+    ensure_coins(num_coin);
+    for(int r=1;r<=min(num_coin, max_coins);r++)
+        flag_coin[r] = sim.coin_alive[r];
+}
+
+/* Advances the fixed-point simulation and mirrors it into the globals used for drawing */
+void deterministic_tick(){
+    bool flying = sim.shoot;
+    int events = sim_tick(sim);
+    for(int r=1;r<=min(num_coin, max_coins);r++)
+        if(flag_coin[r] && !sim.coin_alive[r])
+        {
+            emit_particles(PARTICLE_COIN, centerx_coin[r], centery_coin[r], 2000, 3);
+            current_shot.coins++;
+        }
+    mirror_sim();
+    if(events & SIM_BOUNCED)
+    {
+        bounce_particles();
+        current_shot.bounces++;
+    }
+    if(flying && !sim.shoot && !(events & SIM_TRAPPED))
+        journal_shot_end(SHOT_RESTED);
+
+    if(hash_log)
+        fprintf(hash_log, "%llu %016llx\n", (unsigned long long)sim.tick, (unsigned long long)sim_hash(sim));
+
+    if(events & SIM_COIN_COLLECTED)
+        cout<<"Your current Score is "<<score<<endl;
+    if(events & SIM_LEVEL_UP)
+    {
+        ensure_coins(num_coin);
+        cout<<"Hurray , You are now one level up!! "<<endl;
+        cout<<"Current level is "<<level<<endl;
+    }
+    if(events & SIM_GAME_COMPLETE)
+        exit_func();
+    if(events & SIM_TRAPPED)
+        trap_death();
+}
+
+/****************************************
+ * Rewind                               *
+ ****************************************/
+
+/* Slots of RewindFrame::scalars */
+enum RewindScalar { RW_SHOOT, RW_O, RW_UX, RW_UY, RW_VX, RW_VY, RW_NEWX, RW_NEWY, RW_COLLISIONX, RW_COLLISIONY,
+                    RW_EX, RW_EY, RW_ENERGY, RW_TRAPPY, RW_TRAPPY_DIR, RW_SCORE, RW_LEVEL, RW_NUM_COIN,
+                    RW_LAUNCH_X, RW_LAUNCH_Y };
+
+#define REWIND_BUDGET_BYTES (64*1024)
+#define REWIND_KEYFRAME_INTERVAL 60
+
+int rewind_seconds = 10;
+RewindBuffer rewind_buffer(REWIND_BUDGET_BYTES, rewind_seconds*60, REWIND_KEYFRAME_INTERVAL);
+RewindFrame rewind_frame; // scratch, keeps its coin storage between ticks
+bool rewind_refusing = false;   // the frames are over the budget, nothing is recorded
+
+/* Number of coin flags a snapshot holds */
+int rewind_coin_count ()
+{
+    if(deterministic_physics)
+        return max_coins+1;
+    return flag_coin.size();
+}
+
+/* Takes the state the next ticks depend on, in deterministic mode straight from the fixed-point sim.
+   Fixed-point values survive the trip through double exactly */
+void capture_frame (RewindFrame& frame)
+{
+    double* v = frame.scalars;
+    if(deterministic_physics)
+    {
+        v[RW_SHOOT] = sim.shoot; v[RW_O] = fx_to_double(sim.o);
+        v[RW_UX] = fx_to_double(sim.ux); v[RW_UY] = fx_to_double(sim.uy);
+        v[RW_VX] = fx_to_double(sim.vx); v[RW_VY] = fx_to_double(sim.vy);
+        v[RW_NEWX] = fx_to_double(sim.newx); v[RW_NEWY] = fx_to_double(sim.newy);
+        v[RW_COLLISIONX] = fx_to_double(sim.collisionx); v[RW_COLLISIONY] = fx_to_double(sim.collisiony);
+        v[RW_EX] = fx_to_double(sim.ex); v[RW_EY] = fx_to_double(sim.ey);
+        v[RW_ENERGY] = fx_to_double(sim.energy);
+        v[RW_TRAPPY] = fx_to_double(sim.trappy); v[RW_TRAPPY_DIR] = fx_to_double(sim.trappy_dir);
+        v[RW_SCORE] = sim.score; v[RW_LEVEL] = sim.level; v[RW_NUM_COIN] = sim.num_coin;
+        v[RW_LAUNCH_X] = 0; v[RW_LAUNCH_Y] = 0;
+    }
+    else
+    {
+        v[RW_SHOOT] = shoot; v[RW_O] = o;
+        v[RW_UX] = ux; v[RW_UY] = uy;
+        v[RW_VX] = vx; v[RW_VY] = vy;
+        v[RW_NEWX] = newx; v[RW_NEWY] = newy;
+        v[RW_COLLISIONX] = collisionx; v[RW_COLLISIONY] = collisiony;
+        v[RW_EX] = ex; v[RW_EY] = ey;
+        v[RW_ENERGY] = energy;
+        v[RW_TRAPPY] = trappy; v[RW_TRAPPY_DIR] = dir;
+        v[RW_SCORE] = score; v[RW_LEVEL] = level; v[RW_NUM_COIN] = num_coin;
+        v[RW_LAUNCH_X] = launch_x; v[RW_LAUNCH_Y] = launch_y;
+    }
+
+    int coins = rewind_coin_count();
+    frame.coins.assign((coins+63)/64, 0);
+    for(int r=0;r<coins;r++)
+        if(deterministic_physics ? sim.coin_alive[r] != 0 : flag_coin[r])
+            frame.coins[r/64] |= (uint64_t)1 << (r%64);
+}
+
+void apply_frame (const RewindFrame& frame)
+{
+    const double* v = frame.scalars;
+    int coins = rewind_coin_count();
+    if(deterministic_physics)
+    {
+        sim.shoot = v[RW_SHOOT] != 0; sim.o = FX(v[RW_O]);
+        sim.ux = FX(v[RW_UX]); sim.uy = FX(v[RW_UY]);
+        sim.vx = FX(v[RW_VX]); sim.vy = FX(v[RW_VY]);
+        sim.newx = FX(v[RW_NEWX]); sim.newy = FX(v[RW_NEWY]);
+        sim.collisionx = FX(v[RW_COLLISIONX]); sim.collisiony = FX(v[RW_COLLISIONY]);
+        sim.ex = FX(v[RW_EX]); sim.ey = FX(v[RW_EY]);
+        sim.energy = FX(v[RW_ENERGY]);
+        sim.trappy = FX(v[RW_TRAPPY]); sim.trappy_dir = FX(v[RW_TRAPPY_DIR]);
+        sim.score = v[RW_SCORE]; sim.level = v[RW_LEVEL]; sim.num_coin = v[RW_NUM_COIN];
+        for(int r=0;r<coins;r++)
+            sim.coin_alive[r] = (frame.coins[r/64] >> (r%64)) & 1;
+        mirror_sim();
+    }
+    else
+    {
+        shoot = v[RW_SHOOT] != 0; o = v[RW_O];
+        ux = v[RW_UX]; uy = v[RW_UY];
+        vx = v[RW_VX]; vy = v[RW_VY];
+        newx = v[RW_NEWX]; newy = v[RW_NEWY];
+        collisionx = v[RW_COLLISIONX]; collisiony = v[RW_COLLISIONY];
+        ex = v[RW_EX]; ey = v[RW_EY];
+        energy = v[RW_ENERGY];
+        trappy = v[RW_TRAPPY]; dir = v[RW_TRAPPY_DIR];
+        score = v[RW_SCORE]; level = v[RW_LEVEL]; num_coin = v[RW_NUM_COIN];
+        launch_x = v[RW_LAUNCH_X]; launch_y = v[RW_LAUNCH_Y];
+        sweep_valid = false;
+        // coins placed after the frame was taken were still in play then
+        for(int r=0;r<coins;r++)
+            flag_coin[r] = r/64 < (int)frame.coins.size() ? (frame.coins[r/64] >> (r%64)) & 1 : 1;
+    }
+    ensure_coins(num_coin);
+}
+
+/* Appends the state after this tick's physics to the rewind buffer */
+void record_rewind_frame ()
+{
+    game_tick++;
+    capture_frame(rewind_frame);
+    bool refused = !rewind_buffer.record(game_tick, rewind_frame);
+    if(refused != rewind_refusing)
+    {
+        if(refused)
+            printf("Rewind: a frame takes %zu bytes, over the %zu byte budget, undo is off until it fits\n",
+                   RewindBuffer::keyframe_bytes(rewind_frame), rewind_buffer.budget());
+        rewind_refusing = refused;
+    }
+    if(refused)
+        shot_ticks.clear();
+    // shots that fell out of the window can no longer be undone
+    while(!shot_ticks.empty() && shot_ticks[0] < rewind_buffer.oldest_tick())
+        shot_ticks.erase(shot_ticks.begin());
+}
+
+/* Puts the game back to the tick before the last shot, repeated presses walk back shot by shot */
+void undo_shot ()
+{
+    if(shot_ticks.empty() || !rewind_buffer.restore(shot_ticks.back(), rewind_frame))
+    {
+        cout<<"Nothing to undo in the last "<<rewind_seconds<<" seconds"<<endl;
+        return;
+    }
+    journal_shot_end(SHOT_UNDONE);
+    game_tick = shot_ticks.back();
+    shot_ticks.pop_back();
+    apply_frame(rewind_frame);
+    rewind_buffer.truncate_after(game_tick, rewind_frame);
+    cout<<"Shot undone, your current Score is "<<score<<endl;
+}
+
+void RenderString(float x, float y, void *font , string str, float r, float g, float b)
+{
+	char *c;
+	glColor3f(r, g, b);
+	glShadeModel(GL_SMOOTH);
+	glRasterPos2f(x, y);
+  	for(string::iterator it = str.begin(); it!=str.end();it++)
+	{
+		glutBitmapCharacter(font, *it);
+	}
+}
+
+void print_resource_stats ()
+{
+    printf("GPU resources live: %ld buffers (%ld bytes), %ld vertex arrays, %ld programs\n",
+           gpu_stats.buffers, gpu_stats.buffer_bytes, gpu_stats.vertex_arrays, gpu_stats.programs);
+    printf("Buffer pool: %ld buffers (%ld bytes) parked, %ld requests recycled\n",
+           gpu_stats.pooled_buffers, gpu_stats.pooled_bytes, gpu_stats.recycled);
+}
+
+/* Frees every GL object we own, anything still counted afterwards has leaked */
+void release_gpu_resources ()
+{
+    pool_release(coin_pool);
+    pool_release(object_pool);
+    coins_created = 0;
+    coin_vertex_buffer.reset();
+    coin_color_buffer.reset();
+    coin_shape_buffer.reset();
+    programID.reset();
+    trim_buffer_pool();
+    destroy_resolution_target();
+    release_latency_fences();
+    release_particles();
+    if(gpu_timers.supported)
+        glDeleteQueries(GPU_QUERY_RING*NUM_DRAW_GROUPS, &gpu_timers.queries[0][0]);
+    gpu_timers.supported = false;
+
+    if(gpu_stats.buffers || gpu_stats.vertex_arrays || gpu_stats.programs || gpu_stats.pooled_buffers)
+    {
+        cout<<"Leaked GPU resources:"<<endl;
+        print_resource_stats();
+    }
+}
+
+/* Looks up the shot that collects most of the remaining coins in the shot index */
+void print_hint ()
+{
+    if(shot_index.map == NULL)
+    {
+        cout<<"No shot index loaded, start with --shot-index FILE"<<endl;
+        return;
+    }
+    vector<int> cells;
+    for(int r=1;r<=num_coin;r++)
+        if(flag_coin[r])
+            cells.push_back(shot_index_cell(centerx_coin[r], centery_coin[r]));
+    int covered;
+    int best = shot_index_best(shot_index, cells, covered);
+    if(best < 0)
+    {
+        cout<<"No single shot reaches the remaining coins"<<endl;
+        return;
+    }
+    printf("Best shot: canon rotation %.0f power %.1f collects %d of %d coins\n",
+           shot_index.shots[best].rotation, shot_index.shots[best].power, covered, (int)cells.size());
+}
+
+/* Prints the instrumentation counters of the last frame */
+void print_stats ()
+{
+    cout<<"Objects visible: "<<last_cull_stats.visible<<" culled: "<<last_cull_stats.culled<<endl;
+    print_resource_stats();
+    printf("Frame arena: %zu of %zu bytes used last frame (grows to %zu at most), peak %zu, %ld overflows\n",
+           frame_arena.last_frame, frame_arena.capacity, frame_arena.max_capacity, frame_arena.peak, frame_arena.overflows);
+    printf("Resolution: %dx%d window, scale %.2f, GPU frame %.2f ms of %.2f budget, %ld target resizes\n",
+           window_width, window_height, dyn_res.scale, dyn_res.cost_ms, dyn_res.budget_ms, dyn_res.resizes);
+    printf("Rewind: %zu frames (%zu keyframes) over %.1f s, %zu of %zu bytes, %zu shots undoable, %zu frames refused\n",
+           rewind_buffer.frames(), rewind_buffer.keyframes(), rewind_buffer.frames()/60.0,
+           rewind_buffer.bytes(), rewind_buffer.budget(), shot_ticks.size(), rewind_buffer.refused());
+    printf("Render queue: %ld commands, %ld drawn unsorted\n", last_render_stats.commands, last_render_stats.immediate);
+    printf("  %-14s %10s %10s\n", "state", "submitted", "skipped");
+    for(int st=0;st<NUM_RENDER_STATES;st++)
+        printf("  %-14s %10ld %10ld\n", render_state_names[st], last_render_stats.submitted[st], last_render_stats.skipped[st]);
+    print_latency();
+    if(tracer.enabled())
+        printf("Trace: %zu events recorded, %zu dropped\n", tracer.events(), tracer.dropped());
+    print_world_stats();
+    if(jobs)
+        printf("Jobs: %d threads, %ld jobs run, %ld stolen\n", jobs->size(), jobs->executed(), jobs->stolen());
+    if(shot_journal.is_open())
+        printf("Shot journal: %ld shots in %ld blocks, %ld bytes written, %ld failed writes\n",
+               shot_journal.shots(), shot_journal.blocks(), shot_journal.bytes(), shot_journal.failures());
+    if(particles.supported)
+        printf("Particles: %d in the ring, %ld bursts, %ld particles spawned, %ld bursts deferred\n",
+               particles.capacity, particles.bursts, particles.spawned, particles.deferred);
+    // the GL call counts of a -DGL_TRACE build, or the null renderer's draws
+    renderer->print_stats();
+    if(!gpu_timers.supported)
+        return;
+    collect_gpu_timers();
+    cout<<"GPU time per draw group (ms), "<<gpu_timers.dropped<<" samples dropped:"<<endl;
+    printf("  %-14s %8s %8s %8s %8s %12s\n", "group", "samples", "avg", "min", "max", "vertices/frame");
+    for(int g=0;g<NUM_DRAW_GROUPS;g++)
+    {
+        long n = gpu_timers.samples[g];
+        // every frame drew its vertices, timed or not, so they are averaged over all of them
+        long frames = max(gpu_timers.frames - 1, 1L);
+        printf("  %-14s %8ld %8.4f %8.4f %8.4f %12.1f\n", draw_group_names[g], n,
+               n ? gpu_timers.total_ms[g]/n : 0.0, gpu_timers.min_ms[g], gpu_timers.max_ms[g],
+               (double)gpu_timers.total_vertices[g]/frames);
+    }
+}
+
+/* Prints how long each startup phase took and the time to first frame */
+void report_startup ()
+{
+    cout<<"Startup times (ms):"<<endl;
+    for(int p=0;p<NUM_STARTUP_PHASES;p++)
+        printf("  %-10s %8.2f\n", startup_phase_names[p], startup_phase_ms[p]);
+    printf("  %-10s %8.2f\n", "first frame", elapsed_ms(startup_begin));
+    cout<<"Coin VAOs created: "<<coins_created<<" for "<<num_coin<<" coins in play"<<endl;
+    startup_reported = true;
+}
+
+/****************************************
+ * Stress mode                          *
+ ****************************************/
+/* --stress grows the level to 10k, 100k and 1M coins with STRESS_BLOCKS extra blocks,
+   fires a new shot whenever the ball rests and times STRESS_FRAMES frames at each size.
+   Frame time is the CPU time of draw() up to the swap, physics time the tick inside it.
+   Memory is the resident set, the per-coin arrays and the live GPU buffers */
+#define STRESS_BLOCKS 48
+#define STRESS_WARMUP_FRAMES 30
+#define STRESS_FRAMES 300
+const int stress_sizes[] = { 10000, 100000, 1000000 };
+#define NUM_STRESS_SIZES (int)(sizeof(stress_sizes)/sizeof(stress_sizes[0]))
+
+struct StressBlock {
+    float x, y;
+    float angle;        // degrees
+};
+typedef struct StressBlock StressBlock;
+
+struct StressRun {
+    bool active;
+    int stage;          // index into stress_sizes
+    int frame;          // frames drawn at this size, warm-up included
+    double setup_ms;    // growing the level to this size, VAOs included
+    double frame_ms, frame_max_ms;
+    double physics_ms, physics_max_ms;
+    double gpu_ms;
+    vector<StressBlock> blocks;
+};
+typedef struct StressRun StressRun;
+
+StressRun stress = { false, 0, 0, 0, 0, 0, 0, 0, 0, vector<StressBlock>() };
+double last_physics_ms = 0;
+bool headless = false;
+long autoplay_shots = 0;
+
+/* Nobody is at the controls, shots are fired by autoplay_shot */
+bool autoplay_active () { return stress.active || headless; }
+
+/* Fires the next of a fixed sweep of shots once the ball has come to rest */
+void autoplay_shot ()
+{
+    if(shoot)
+        return;
+    canon_rotation = 15 + (autoplay_shots*37)%150;
+    power_meter = 6 + autoplay_shots%9;
+    shoot_func();
+    autoplay_shots++;
+}
+
+double resident_mb ()
+{
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(statm == NULL)
+        return 0;
+    if(fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1024*1024);
+}
+
+/* Scatters the extra blocks over the play area, they collide like the level's own */
+void place_stress_blocks ()
+{
+    for(int b=0;b<STRESS_BLOCKS;b++)
+    {
+        StressBlock block = { (float)(rand()%60 - 35)/10, (float)(rand()%50 - 25)/10, (float)(rand()%180) };
+        int o = obstacle_add(obstacles, OBSTACLE_SOLID, 1.2, 1.2);
+        obstacle_place(obstacles, o, block.x, block.y, block.angle*M_PI/180, 0, 0, 1.2, 0.2, 0, 0, 0);
+        stress.blocks.push_back(block);
+    }
+}
+
+/* Grows the level to the size of the current stage and restarts the counters */
+void begin_stress_stage ()
+{
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    num_coin = stress_sizes[stress.stage];
+    ensure_coins(num_coin);
+    for(int r=1;r<=num_coin;r++)
+        flag_coin[r] = true;
+    score = 0;
+    stress.setup_ms = elapsed_ms(begin);
+    stress.frame = 0;
+    stress.frame_ms = stress.frame_max_ms = 0;
+    stress.physics_ms = stress.physics_max_ms = 0;
+    stress.gpu_ms = 0;
+}
+
+void start_stress ()
+{
+    place_stress_blocks();
+    printf("Stress run, %d blocks, %d frames per size\n", (int)obstacles.flags.size(), STRESS_FRAMES);
+    printf("%9s %10s %17s %17s %8s %12s %10s %10s %9s\n", "coins", "setup ms", "frame avg/max ms",
+           "physics avg/max", "GPU ms", "resident MB", "coins MB", "GPU MB", "VAOs");
+    begin_stress_stage();
+}
+
+/* Called after every frame of a stress run with the CPU time of the frame */
+void stress_frame (double frame_ms)
+{
+    if(++stress.frame <= STRESS_WARMUP_FRAMES)
+        return;
+    stress.frame_ms += frame_ms;
+    stress.frame_max_ms = max(stress.frame_max_ms, frame_ms);
+    stress.physics_ms += last_physics_ms;
+    stress.physics_max_ms = max(stress.physics_max_ms, last_physics_ms);
+    stress.gpu_ms += gpu_timers.last_frame_ms;
+    if(stress.frame < STRESS_WARMUP_FRAMES + STRESS_FRAMES)
+        return;
+
+    printf("%9d %10.1f %8.2f/%-8.2f %8.3f/%-8.3f %8.2f %12.1f %10.1f %10.1f %9ld\n", num_coin, stress.setup_ms,
+           stress.frame_ms/STRESS_FRAMES, stress.frame_max_ms, stress.physics_ms/STRESS_FRAMES, stress.physics_max_ms,
+           gpu_timers.supported ? stress.gpu_ms/STRESS_FRAMES : 0.0, resident_mb(), coin_storage_bytes()/(1024.0*1024),
+           gpu_stats.buffer_bytes/(1024.0*1024), gpu_stats.vertex_arrays);
+    fflush(stdout);
+    if(++stress.stage == NUM_STRESS_SIZES)
+    {
+        stress.active = false;
+        exit_func();
+    }
+    begin_stress_stage();
+}
+
+void draw ()
+{
+  TraceZone frame_zone("frame");
+  TraceZone stage("input");
+  reset_frame_arena(frame_arena);
+  chrono::steady_clock::time_point frame_begin = chrono::steady_clock::now();
+  drain_input();
+  // the animations run on the tick this frame's physics ends on, none passes once the game is over
+  frame_time = (double)(game_tick + (game_over ? 0 : 1))/ANIMATION_FRAME_RATE;
+
+  // binds the scene target and clears the color and depth in the frame buffer
+  stage.next("begin frame");
+  renderer->begin_frame(frame_time);
+
+  // Eye - Location of camera. Don't change unless you are sure!!
+  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
+  // Target - Where is the camera looking at.  Don't change unless you are sure!!
+  glm::vec3 target (0, 0, 0);
+  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
+  glm::vec3 up (0, 1, 0);
 
   // Compute Camera matrix (view)
   // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
   //  Don't change unless you are sure!!
-  Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+  stage.next("camera and streaming");
+  update_camera();
+  Matrices.view = camera_view(); // Camera for 2D (ortho) in XY plane, panned by panx/pany
+  stream_world();
 
   // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
   //  Don't change unless you are sure!!
   glm::mat4 VP = Matrices.projection * Matrices.view;
+  extract_view_planes(VP);
+  cull_stats.visible = 0;
+  cull_stats.culled = 0;
 
-  // Send our transformation to the currently bound shader, in the "MVP" uniform
-  // For each model you render, since the MVP will be different (at least the M part)
-  //  Don't change unless you are sure!!
+  // Every draw is queued with its own MVP, the back end uploads it when it changes
   glm::mat4 MVP;	// MVP = Projection * View * Model
 
   // Load identity to model matrix
   /* Render your scene */
 
 
-  // rectangle , left-up most
-  Matrices.model = glm::mat4(1.0f);
+  stage.next("queue world");
+  next_render_stats_frame();
+  begin_render_queue(render_queue, RENDER_QUEUE_FIXED_DRAWS + stress.blocks.size() + num_coin + world_draws());
 
-  glm::mat4 translateRectangle = glm::translate (glm::vec3(-1.7, 2, 0));        // glTranslatef
-  glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateRectangle * rotateRectangle);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  // rectangle , left-up most
+  if(visible_rect(-1.7, 2, rectangle_rotation, 0, 0, 1.2, 0.2))
+  {
+    Matrices.model = glm::mat4(1.0f);
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle);
+    glm::mat4 translateRectangle = glm::translate (glm::vec3(-1.7, 2, 0));        // glTranslatef
+    glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+    Matrices.model *= (translateRectangle * rotateRectangle);
+    MVP = VP * Matrices.model;
+    queue_draw(render_queue, GROUP_WORLD, 0, rectangle, MVP);
+  }
 
   // rectangle 2 , right-up most
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateRectangle2 = glm::translate (glm::vec3(2.4, 2, 0));        // glTranslatef
-  glm::mat4 rotateRectangle2 = glm::rotate((float)(rectangle2_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateRectangle2 * rotateRectangle2);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  if(visible_rect(2.4, 2, rectangle2_rotation, 0, 0, 1.2, 0.2))
+  {
+    Matrices.model = glm::mat4(1.0f);
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle2);
+    glm::mat4 translateRectangle2 = glm::translate (glm::vec3(2.4, 2, 0));        // glTranslatef
+    glm::mat4 rotateRectangle2 = glm::rotate((float)(rectangle2_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+    Matrices.model *= (translateRectangle2 * rotateRectangle2);
+    MVP = VP * Matrices.model;
+    queue_draw(render_queue, GROUP_WORLD, 0, rectangle2, MVP);
+  }
 
   // rectangle3 , rough-ground
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translateRectangle3 = glm::translate (glm::vec3(0.7, -3.2, 0));        // glTranslatef
-  glm::mat4 rotateRectangle3 = glm::rotate((float)(rectangle3_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateRectangle3 * rotateRectangle3);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle3);
+  if(visible_rect(0.7, -3.2, rectangle3_rotation, 0, 0, 1.2, 0.2))
+  {
+    Matrices.model = glm::mat4(1.0f);
 
-  RenderString(0,0,GLUT_BITMAP_TIMES_ROMAN_10,(string)"dsf",0,0,0);
+    glm::mat4 translateRectangle3 = glm::translate (glm::vec3(0.7, -3.2, 0));        // glTranslatef
+    glm::mat4 rotateRectangle3 = glm::rotate((float)(rectangle3_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+    Matrices.model *= (translateRectangle3 * rotateRectangle3);
+    MVP = VP * Matrices.model;
+    queue_draw(render_queue, GROUP_WORLD, 0, rectangle3, MVP);
+  }
 
   // rectangle5 , ground
-  Matrices.model = glm::mat4(1.0f);
+  const LevelBlock& ground = level_blocks[LEVEL_GROUND];
+  if(visible_rect(ground.pivot_x, ground.pivot_y, rectangle5_rotation, ground.x0, ground.y0, ground.x1, ground.y1))
+  {
+    Matrices.model = glm::mat4(1.0f);
 
-  glm::mat4 translateRectangle5 = glm::translate (glm::vec3(-1.7, -3.4, 0));        // glTranslatef
-  glm::mat4 rotateRectangle5 = glm::rotate((float)(rectangle5_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateRectangle5 * rotateRectangle5);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+    glm::mat4 translateRectangle5 = glm::translate (glm::vec3(-1.7, -3.4, 0));        // glTranslatef
+    glm::mat4 rotateRectangle5 = glm::rotate((float)(rectangle5_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+    Matrices.model *= (translateRectangle5 * rotateRectangle5);
+    MVP = VP * Matrices.model;
+    queue_draw(render_queue, GROUP_WORLD, 0, rectangle5, MVP);
+  }
+
+  // blocks added by the stress mode share the first rectangle's mesh
+  for(size_t b=0;b<stress.blocks.size();b++)
+  {
+    const StressBlock& block = stress.blocks[b];
+    if(!visible_rect(block.x, block.y, block.angle, 0, 0, 1.2, 0.2))
+      continue;
+    glm::mat4 translateBlock = glm::translate (glm::vec3(block.x, block.y, 0));
+    glm::mat4 rotateBlock = glm::rotate((float)(block.angle*M_PI/180.0f), glm::vec3(0,0,1));
+    MVP = VP * (translateBlock * rotateBlock);
+    queue_draw(render_queue, GROUP_WORLD, 0, rectangle, MVP);
+  }
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle5);
+  // the streamed world chunks and their coins
+  queue_world(render_queue, VP);
 
   // coins1 , beside ground block
   // coins2 ,at last of ground
@@ -1002,135 +3180,156 @@ void draw ()
   // coins5 up-right most coin
   // coins6 , insude water
 
-  glm::mat4 translatecoins[num_coin+1],rotatecoins[num_coin+1],coinsTransform[num_coin+1];
-  for(int r=1;r<=num_coin;r++)
-  {
-
-      Matrices.model = glm::mat4(1.0f);
-
-       translatecoins[r] = glm::translate (glm::vec3(centerx_coin[r] , centery_coin[r], 0.0f)); // glTranslatef
-       rotatecoins[r] = glm::rotate((float)(coins_rotation[r]*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0) , vec3 decides the axis about which it have to be rotated
-       coinsTransform[r] = translatecoins[r] ;
-      Matrices.model *= translatecoins[r] * rotatecoins[r];
-      MVP = VP * Matrices.model; // MVP = p * V * M
-
-      //  Don't change unless you are sure!!
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-      // draw3DObject draws the VAO given to it using current MVP matrix
-      if(flag_coin[r]==true)
-          draw3DObject(coins[r]);
-  }
+  // collected and off-screen coins never get a matrix built, they spin in the vertex shader
+  stage.next("queue coins");
+  queue_coins(render_queue, VP);
 
       // bird3
     Matrices.model = glm::mat4(1.0f);
 
     // o defines time
-    o += 0.01;
-    accelaration_func();
-    move_func();
-    collect_coins();
-    friction_coefficient();
-    collision_func();
-    trapping_box();
-
-    glm::mat4 translatebird3 = glm::translate (glm::vec3(-3.00f + collisionx+newx , -3.00f + collisiony+newy , 0.0f)); // glTranslatef
-    glm::mat4 rotatebird3 = glm::rotate((float)((bird3_rotation+20)*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0) , vec3 decides the axis about which it have to be rotated
-    glm::mat4 bird3Transform = translatebird3 ;
-    Matrices.model *= translatebird3 * rotatebird3;
-    MVP = VP * Matrices.model; // MVP = p * V * M
-
-    //  Don't change unless you are sure!!
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(bird3);
+    stage.next("physics");
+    chrono::steady_clock::time_point physics_begin = chrono::steady_clock::now();
+    if(game_over)
+    {
+        // trapped, only the particles move until the exit
+        if(chrono::steady_clock::now() >= game_over_at)
+            exit_func();
+    }
+    else if(deterministic_physics)
+    {
+        deterministic_tick();
+        record_rewind_frame();
+    }
+    else
+    {
+        o += 0.01;
+        accelaration_func();
+        move_func();
+        collect_coins();
+        update_obstacles();
+        collision_func();
+        trapping_box();
+        record_rewind_frame();
+    }
+    last_physics_ms = elapsed_ms(physics_begin);
+    stage.next("queue ball and canon");
 
-    // bird2
-    Matrices.model = glm::mat4(1.0f);
+    if(visible_circle(-3.00f + collisionx+newx, -3.00f + collisiony+newy, radius_object))
+    {
+      glm::mat4 translatebird3 = glm::translate (glm::vec3(-3.00f + collisionx+newx , -3.00f + collisiony+newy , 0.0f)); // glTranslatef
+      glm::mat4 rotatebird3 = glm::rotate((float)((bird3_rotation+20)*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0) , vec3 decides the axis about which it have to be rotated
+      glm::mat4 bird3Transform = translatebird3 ;
+      Matrices.model *= translatebird3 * rotatebird3;
+      MVP = VP * Matrices.model; // MVP = p * V * M
 
+      queue_draw(render_queue, GROUP_BALL_CANON, 0, bird3, MVP);
+    }
 
-    glm::mat4 translatebird2 = glm::translate (glm::vec3(-3.0f, -3.0f, 0.0f)); // glTranslatef
-    glm::mat4 rotatebird2 = glm::rotate((float)(bird2_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0) , vec3 decides the axis about which it have to be rotated
-    glm::mat4 bird2Transform = translatebird2 ;
-    Matrices.model *= translatebird2 * rotatebird2;
-    MVP = VP * Matrices.model; // MVP = p * V * M
+    // bird2, the canon and its base stand where the shot starts
+    float canon_x = -3 + launch_x, canon_y = -3 + launch_y;
+    if(visible_circle(canon_x, canon_y, radius_object))
+    {
+      Matrices.model = glm::mat4(1.0f);
 
-    //  Don't change unless you are sure!!
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+      glm::mat4 translatebird2 = glm::translate (glm::vec3(canon_x, canon_y, 0.0f)); // glTranslatef
+      glm::mat4 rotatebird2 = glm::rotate((float)(bird2_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0) , vec3 decides the axis about which it have to be rotated
+      glm::mat4 bird2Transform = translatebird2 ;
+      Matrices.model *= translatebird2 * rotatebird2;
+      MVP = VP * Matrices.model; // MVP = p * V * M
 
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(bird2);
+      queue_draw(render_queue, GROUP_BALL_CANON, 1, bird2, MVP);
+    }
 
   // bird1
   Matrices.model = glm::mat4(1.0f);
 
-  moving_wheelx -= 0.017f;
-  if(moving_wheelx <= -4.1f)
-    moving_wheelx = 4.25f;
-  glm::mat4 translatebird1 = glm::translate (glm::vec3(moving_wheelx, -3.7f, 0.0f)); // glTranslatef
-  glm::mat4 rotatebird1 = glm::rotate((float)(bird1_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0) , vec3 decides the axis about which it have to be rotated
-  glm::mat4 bird1Transform = translatebird1 ;
-  Matrices.model *= translatebird1 * rotatebird1;
-  MVP = VP * Matrices.model; // MVP = p * V * M
-
-  //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  // rolls along wheel_animation from 4.25, only the culling needs to know where it is now
+  if(visible_circle(4.25f + animation_offset(wheel_animation, frame_time).x, -3.7f, radius_object))
+  {
+    glm::mat4 translatebird1 = glm::translate (glm::vec3(4.25f, -3.7f, 0.0f)); // glTranslatef
+    Matrices.model *= translatebird1;
+    MVP = VP * Matrices.model; // MVP = p * V * M
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(bird1);
+    queue_draw(render_queue, GROUP_BALL_CANON, 1, bird1, MVP, wheel_animation);
+  }
 
   // canon
-  Matrices.model = glm::mat4(1.0f);
-
-  glm::mat4 translatecanon = glm::translate (glm::vec3(-3,-3, 0));        // glTranslatef
-  glm::mat4 rotatecanon = glm::rotate((float)((canon_rotation)*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (0,0,1)
-  Matrices.model *= (translatecanon * rotatecanon);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  if(visible_rect(canon_x, canon_y, canon_rotation, 0, -0.5, 2.5, 0.5))
+  {
+    Matrices.model = glm::mat4(1.0f);
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(canon);
+    glm::mat4 translatecanon = glm::translate (glm::vec3(canon_x, canon_y, 0));        // glTranslatef
+    glm::mat4 rotatecanon = glm::rotate((float)((canon_rotation)*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (0,0,1)
+    Matrices.model *= (translatecanon * rotatecanon);
+    MVP = VP * Matrices.model;
+    // the barrel outline goes over the canon, the trap shares its layer
+    queue_draw(render_queue, GROUP_BALL_CANON, 2, canon, MVP);
+    queue_draw(render_queue, GROUP_BALL_CANON, 3, canon_barrel, MVP);
+  }
 
-  // rectangle6 , ground
-  Matrices.model = glm::mat4(1.0f);
+  // rectangle4 , water base, moved by trap_animation unless the deterministic mode steps it
+  bool trap_animated = !deterministic_physics;
+  double trap_y = trap_animated ? TRAP_LOW + animation_offset(trap_animation, frame_time).y : trappy;
+  if(visible_rect(2, trap_y, rectangle4_rotation, 0.4, 0.3, 0.8, 0.7))
+  {
+    Matrices.model = glm::mat4(1.0f);
 
-  glm::mat4 translateRectangle6 = glm::translate (glm::vec3(-1.7+ power_meter -8 , -3.4, 0));        // glTranslatef
-  // glm::mat4 rotateRectangle6 = glm::rotate((float)(rectangle6_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateRectangle6 );
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+    glm::mat4 translateRectangle4 = glm::translate (glm::vec3(2, trap_animated ? TRAP_LOW : trappy, 0));        // glTranslatef
+    glm::mat4 rotateRectangle4 = glm::rotate((float)(rectangle4_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+    Matrices.model *= (translateRectangle4 * rotateRectangle4);
+    MVP = VP * Matrices.model;
+    queue_draw(render_queue, GROUP_BALL_CANON, 3, rectangle4, MVP, trap_animated ? trap_animation : still);
+  }
+  stage.next("submit scene");
+  submit_render_queue(render_queue, GROUP_WORLD, GROUP_BALL_CANON);
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle6);
-  // Swap the frame buffers
+  stage.next("particles");
+  renderer->begin_group(GROUP_PARTICLES);
+  renderer->draw_particles(VP);
+  renderer->end_group();
 
+  stage.next("hud");
+  renderer->end_scene();
 
-  // rectangle4 , water base
-  Matrices.model = glm::mat4(1.0f);
+  begin_render_queue(render_queue, 1);
+  // rectangle6 , power meter, under the canon wherever it stands
+  if(visible_rect(-1.7+ power_meter -8 + launch_x, -3.4 + launch_y, 0, -1800, 0.1, -1, 0.2))
+  {
+    Matrices.model = glm::mat4(1.0f);
 
-  glm::mat4 translateRectangle4 = glm::translate (glm::vec3(2, trappy, 0));        // glTranslatef
-  glm::mat4 rotateRectangle4 = glm::rotate((float)(rectangle4_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-  Matrices.model *= (translateRectangle4 * rotateRectangle4);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+    glm::mat4 translateRectangle6 = glm::translate (glm::vec3(-1.7+ power_meter -8 + launch_x, -3.4 + launch_y, 0));        // glTranslatef
+    // glm::mat4 rotateRectangle6 = glm::rotate((float)(rectangle6_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
+    Matrices.model *= (translateRectangle6 );
+    MVP = VP * Matrices.model;
+    queue_draw(render_queue, GROUP_HUD, 0, rectangle6, MVP);
+  }
+  submit_render_queue(render_queue, GROUP_HUD, GROUP_HUD);
+  if(visible_box(0, 0, 0, 0))
+      renderer->text(0,0,(string)"dsf");
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle4);
+  double frame_ms = elapsed_ms(frame_begin);
+  update_resolution_scale(gpu_timers.last_frame_ms);
 
-  glutSwapBuffers ();
+  // Swap the frame buffers
+  stage.next("swap");
+  renderer->end_frame();
+  last_cull_stats = cull_stats;
+  stage.next("after frame");
+
+  if(startup_reported == false)
+      report_startup ();
+  if(autoplay_active())
+      autoplay_shot();
+  if(stress.active)
+      stress_frame(frame_ms);
 
   // Increment angles
   float increments = 1;
 
   //camera_rotation_angle++; // Simulating camera rotation
-  bird1_rotation = bird1_rotation + increments*bird1_rot_dir*bird1_rot_status;
   bird2_rotation = bird2_rotation + increments*bird2_rot_dir*bird2_rot_status;
   bird3_rotation = bird3_rotation + energy*bird3_rot_dir*bird3_rot_status;
-  for(int r=1;r<=num_coin;r++)
-  {
-      coins_rotation[r] = coins_rotation[r] + (increments+5)*coins_rot_dir[r]*coins_rot_status[r];
-  }
   rectangle_rotation = rectangle_rotation + increments*rectangle_rot_dir*rectangle_rot_status;
   rectangle2_rotation = rectangle2_rotation + increments*rectangle2_rot_dir*rectangle2_rot_status;
   rectangle3_rotation = rectangle3_rotation + increments*rectangle3_rot_dir*rectangle3_rot_status;
@@ -1157,23 +3356,29 @@ void initGL (int width, int height );
 /* Nothing to Edit here */
 void initGLUT (int& argc, char** argv, int width, int height)
 {
+    chrono::steady_clock::time_point phase_begin = chrono::steady_clock::now();
+
     // Init glut
     glutInit (&argc, argv);
 
     // Init glut window
     glutInitDisplayMode (GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
     glutInitContextVersion (3, 3); // Init GL 3.3
-    glutInitContextFlags (GLUT_CORE_PROFILE); // Use Core profile - older functions are deprecated
+    glutInitContextFlags (GLUT_CORE_PROFILE | (gl_trace_debug_context() ? GLUT_DEBUG : 0)); // Use Core profile - older functions are deprecated
     glutInitWindowSize (width, height);
     glutCreateWindow ("D.N.A.H.B Games");
+    startup_phase_ms[PHASE_GLUT] = elapsed_ms(phase_begin);
 
     // Initialize GLEW, Needed in Core profile
+    phase_begin = chrono::steady_clock::now();
     glewExperimental = GL_TRUE;
     GLenum err = glewInit();
     if (err != GLEW_OK) {
         cout << "Error: Failed to initialise GLEW : "<< glewGetErrorString(err) << endl;
         exit (1);
     }
+    startup_phase_ms[PHASE_GLEW] = elapsed_ms(phase_begin);
+    gl_trace_init ();
 
     // register glut callbacks
     glutKeyboardFunc (keyboardDown);
@@ -1205,6 +3410,7 @@ void menu(int op)
     {
         case 'Q':
         case 'q':
+            renderer->release();
             exit(0);
     }
 }
@@ -1225,24 +3431,25 @@ void addGLUTMenus ()
 
 
 /* Initialize the OpenGL rendering properties */
-/* Add all the models to be created here */
 void initGL (int width, int height )
 {
-	// Create the models
-	createRectangle ();
-	create_angry_bird (0,0); // Generate the VAO, VBOs, vertices data & copy into the array buffer
-    createcanon (2,0); // pointed at -3   .5,-3
-    ground_rectangle();
-    water_rectangle();
-    create_angry_coins(0,0);
-    power_rectangle();
+	TraceZone zone("init GL");
 	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
+	chrono::steady_clock::time_point phase_begin = chrono::steady_clock::now();
+	programID = GLProgram(LoadShaders( "Sample_GL.vert", "Sample_GL.frag" ));
 	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
-
-
-	reshapeWindow (width, height);
+	Matrices.MatrixID = glGetUniformLocation(programID.id(), "MVP");
+	animation_uniforms.time = glGetUniformLocation(programID.id(), "time");
+	animation_uniforms.spin = glGetUniformLocation(programID.id(), "spin");
+	animation_uniforms.path = glGetUniformLocation(programID.id(), "path");
+	animation_uniforms.bounce = glGetUniformLocation(programID.id(), "bounce");
+	startup_phase_ms[PHASE_SHADERS] = elapsed_ms(phase_begin);
+
+	TraceZone stage("init GPU timers");
+	init_gpu_timers ();
+	stage.next("init particles");
+	init_particles ();
+	stage.end();
 
 	// Background color of the scene
 	glClearColor (0.55,0.55,0.55, 0.0f); // R, G, B, A
@@ -1251,6 +3458,10 @@ void initGL (int width, int height )
 	glEnable (GL_DEPTH_TEST);
 	glDepthFunc (GL_LEQUAL);
 
+	// circle edges are antialiased through their alpha
+	glEnable (GL_BLEND);
+	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
 
 	cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
 	cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
@@ -1258,18 +3469,394 @@ void initGL (int width, int height )
 	cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* Add all the models to be created here, they are made by the renderer in use */
+void init_game (int width, int height)
+{
+	// Create the models
+	TraceZone zone("init game");
+	TraceZone stage("create geometry");
+	chrono::steady_clock::time_point phase_begin = chrono::steady_clock::now();
+	createRectangle ();
+	create_angry_bird (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
+    createcanon (); // pointed at -3   .5,-3
+    ground_rectangle();
+    water_rectangle();
+    create_angry_coins();
+    ensure_coins(num_coin);
+    power_rectangle();
+	startup_phase_ms[PHASE_GEOMETRY] = elapsed_ms(phase_begin);
+
+	stage.next("start jobs");
+	init_frame_arena (frame_arena, FRAME_ARENA_BYTES);
+	jobs = new JobSystem(job_threads > 0 ? job_threads : max(1u, thread::hardware_concurrency()));
+	stage.next("init world");
+	init_obstacles ();
+	init_world ();
+	if(stress.active)
+	{
+	    stage.next("start stress");
+	    start_stress ();
+	}
+	stage.end();
+
+	reshapeWindow (width, height);
+}
+
+/* The GL 3.3 back end, a thin layer over the functions above */
+class GLRenderer : public Renderer {
+public:
+    void init (int width, int height) { initGL(width, height); }
+    VAO* create_object (GLenum primitive_mode, int num_vertices, const GLfloat* vertex_buffer_data,
+                        const GLfloat* color_buffer_data, GLenum fill_mode)
+    {
+        return gl_create_object(primitive_mode, num_vertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    }
+    void attach_circle_shape (VAO* vao, const CircleShape& shape) { gl_attach_circle_shape(vao, shape); }
+    VAO* create_coin_object () { return gl_create_coin_object(); }
+    void release_object (VAO* vao) { pool_free_vao(object_pool, vao); }
+    void resize (int width, int height)
+    {
+        glViewport (0, 0, (GLsizei) width, (GLsizei) height);
+    }
+    void begin_frame (float time)
+    {
+        collect_latency();
+        begin_scene_pass();
+        glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        next_gpu_timer_frame();
+        glUseProgram (programID.id());
+        glUniform1f (animation_uniforms.time, time);
+    }
+    void begin_group (DrawGroup group) { begin_draw_group(group); }
+    void draw (const RenderCommand* commands, int count)
+    {
+        // the state cache only holds within one call, whatever ran in between set its own
+        invalidate_render_state();
+        for(int c=0;c<count;c++)
+            execute_command(commands[c]);
+        invalidate_render_state();
+    }
+    void end_group () { end_draw_group(); }
+    void draw_particles (const glm::mat4& VP)
+    {
+        update_particles();
+        ::draw_particles(VP);
+    }
+    void end_scene () { end_scene_pass(); }
+    void text (float x, float y, const string& str) { RenderString(x, y, GLUT_BITMAP_TIMES_ROMAN_10, str, 0, 0, 0); }
+    void end_frame ()
+    {
+        glutSwapBuffers ();
+        submit_latency_frame();
+        // the first frame is timed to the end of its GPU work
+        if(startup_reported == false)
+            glFinish ();
+        gl_trace_frame ();
+    }
+    void release () { release_gpu_resources(); }
+    void print_stats () { gl_trace_print(); }
+};
+
+/* Makes objects without GPU resources and only counts the draws and vertices it is handed,
+   by draw group. Object names are handed out like GL would so the sort keys still group meshes */
+class NullRenderer : public Renderer {
+public:
+    NullRenderer () : frames_(0), next_name_(1)
+    {
+        memset(draws_, 0, sizeof(draws_));
+        memset(vertices_, 0, sizeof(vertices_));
+    }
+    void init (int width, int height) {}
+    VAO* create_object (GLenum primitive_mode, int num_vertices, const GLfloat* vertex_buffer_data,
+                        const GLfloat* color_buffer_data, GLenum fill_mode)
+    {
+        VAO* vao = new VAO();
+        vao->VertexArrayID = next_name_++;
+        vao->PrimitiveMode = primitive_mode;
+        vao->FillMode = fill_mode;
+        vao->NumVertices = num_vertices;
+        objects_.push_back(vao);
+        return vao;
+    }
+    void attach_circle_shape (VAO* vao, const CircleShape& shape) {}
+    VAO* create_coin_object () { return create_object(GL_TRIANGLES, CIRCLE_VERTICES, NULL, NULL, GL_FILL); }
+    void release_object (VAO* vao)
+    {
+        objects_.erase(find(objects_.begin(), objects_.end(), vao));
+        delete vao;
+    }
+    void resize (int width, int height) {}
+    void begin_frame (float time) {}
+    void begin_group (DrawGroup group) {}
+    void draw (const RenderCommand* commands, int count)
+    {
+        for(int c=0;c<count;c++)
+        {
+            int g = commands[c].key >> KEY_GROUP_SHIFT;
+            draws_[g]++;
+            vertices_[g] += commands[c].vao->NumVertices;
+        }
+    }
+    void end_group () {}
+    void draw_particles (const glm::mat4& VP) {}
+    void end_scene () {}
+    void text (float x, float y, const string& str) {}
+    void end_frame () { frames_++; }
+    void release ()
+    {
+        for(size_t i=0;i<objects_.size();i++)
+            delete objects_[i];
+        objects_.clear();
+        coins_created = 0;
+    }
+    void print_stats ()
+    {
+        printf("Null renderer: %ld frames, %zu objects\n", frames_, objects_.size());
+        printf("  %-14s %12s %14s\n", "group", "draws", "vertices");
+        for(int g=0;g<NUM_DRAW_GROUPS;g++)
+            printf("  %-14s %12ld %14ld\n", draw_group_names[g], draws_[g], vertices_[g]);
+    }
+
+private:
+    vector<VAO*> objects_;
+    long draws_[NUM_DRAW_GROUPS];
+    long vertices_[NUM_DRAW_GROUPS];
+    long frames_;
+    GLuint next_name_;
+};
+
+GLRenderer gl_renderer;
+NullRenderer null_renderer;
+
+/* Runs the game on the null renderer with no window or GL context, as fast as the CPU goes.
+   The shots are fired by autoplay_shot, a stress run sets its own length */
+#define HEADLESS_FRAMES 3600
+int headless_frames = HEADLESS_FRAMES;
+
+void run_headless ()
+{
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    double physics_ms = 0;
+    long frames = 0;
+    for(; stress.active || frames < headless_frames; frames++)
+    {
+        draw();
+        physics_ms += last_physics_ms;
+    }
+    double ms = elapsed_ms(begin);
+    printf("Headless: %ld frames in %.0f ms, %.0f frames/s, physics %.2f us per frame, %ld shots\n",
+           frames, ms, frames*1000.0/max(ms, 1e-3), physics_ms*1000/max(frames, 1L), autoplay_shots);
+    renderer->print_stats();
+    print_world_stats();
+    exit_func();
+}
+
+
+/* Measures headless environment throughput from one thread up to all cores, no window is created */
+void bench_env (int num_envs)
+{
+    int max_threads = max(1u, thread::hardware_concurrency());
+    vector<EnvAction> actions(num_envs);
+    vector<EnvStep> results;
+    cout<<"Environment steps per second, "<<num_envs<<" instances:"<<endl;
+    for(int threads=1;;threads=min(threads*2, max_threads))
+    {
+        VectorEnv envs(num_envs, threads, 1);
+        long steps = 0;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        for(int t=0; elapsed_ms(begin) < 1000; t++)
+        {
+            for(int e=0;e<num_envs;e++)
+            {
+                actions[e].aim = 10 + (e*7)%150;
+                actions[e].power = 6 + e%5;
+                actions[e].shoot = (t+e)%300 == 0;
+            }
+            envs.step(actions, results);
+            steps += num_envs;
+        }
+        printf("  %2d threads %12.0f\n", threads, steps*1000.0/elapsed_ms(begin));
+        if(threads == max_threads)
+            break;
+    }
+}
+
+/* Measures the per-frame coin pass, queue_coins on 'num_coins' coins in the default view, on
+   the job system from one thread up to all cores. The coins are made by the null renderer, no
+   window is created */
+void bench_jobs (int num_coins)
+{
+    int max_threads = job_threads > 0 ? job_threads : max(1u, thread::hardware_concurrency());
+    renderer = &null_renderer;
+    num_coin = num_coins;
+    ensure_coins(num_coin);
+    init_frame_arena(frame_arena, FRAME_ARENA_BYTES + num_coins*sizeof(RenderCommand));
+    reshapeWindow(600, 600);
+    glm::mat4 VP = Matrices.projection * camera_view();
+    extract_view_planes(VP);
+
+    cout<<"Coin passes per second, "<<num_coins<<" coins:"<<endl;
+    printf("  %7s %12s %10s %8s %12s\n", "threads", "passes/s", "ms", "speedup", "stolen/pass");
+    double single = 0;
+    for(int threads=1;;threads=min(threads*2, max_threads))
+    {
+        JobSystem system(threads);
+        jobs = &system;
+        long runs = 0;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        while(elapsed_ms(begin) < 1000)
+        {
+            reset_frame_arena(frame_arena);
+            begin_render_queue(render_queue, num_coin);
+            cull_stats.visible = cull_stats.culled = 0;
+            queue_coins(render_queue, VP);
+            runs++;
+        }
+        double ms = elapsed_ms(begin)/runs;
+        if(threads == 1)
+            single = ms;
+        printf("  %7d %12.1f %10.3f %8.2f %12.1f\n", threads, 1000/ms, ms, single/ms, (double)system.stolen()/runs);
+        jobs = NULL;
+        if(threads == max_threads)
+            break;
+    }
+    printf("%d coins in view, %d culled\n", cull_stats.visible, cull_stats.culled);
+}
+
+/* Reads our own options, anything else is left for glutInit */
+void parse_args (int argc, char** argv)
+{
+    for(int a=1;a<argc;a++)
+    {
+        if(strcmp(argv[a], "--deterministic") == 0)
+            deterministic_physics = true;
+        else if(strcmp(argv[a], "--seed") == 0 && a+1 < argc)
+            sim_seed = strtoull(argv[++a], NULL, 10);
+        else if(strcmp(argv[a], "--hash-log") == 0 && a+1 < argc)
+        {
+            hash_log = fopen(argv[++a], "w");
+            if(hash_log == NULL)
+                cout<<"Could not open hash log "<<argv[a]<<endl;
+            deterministic_physics = true;
+        }
+        else if(strcmp(argv[a], "--build-shot-index") == 0 && a+1 < argc)
+        {
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            if(!shot_index_build(argv[++a], max(1u, thread::hardware_concurrency())))
+            {
+                cout<<"Could not write shot index "<<argv[a]<<endl;
+                exit(1);
+            }
+            printf("Shot index written to %s in %.0f ms\n", argv[a], elapsed_ms(begin));
+            exit(0);
+        }
+        else if(strcmp(argv[a], "--shot-index") == 0 && a+1 < argc)
+        {
+            if(!shot_index_open(shot_index, argv[++a]))
+                cout<<"Shot index "<<argv[a]<<" is missing, damaged or was built for another level layout"<<endl;
+        }
+        else if(strcmp(argv[a], "--shot-journal") == 0 && a+1 < argc)
+        {
+            if(!shot_journal.open(argv[++a]))
+                cout<<"Could not open shot journal "<<argv[a]<<endl;
+            else if(shot_journal.recovered())
+                cout<<"Shot journal "<<argv[a]<<": dropped "<<shot_journal.recovered()<<" bytes of an unfinished block"<<endl;
+        }
+        else if(strcmp(argv[a], "--journal-report") == 0 && a+1 < argc)
+        {
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            ShotJournalStats stats;
+            size_t ignored;
+            if(!shot_journal_aggregate(argv[++a], max(1u, thread::hardware_concurrency()), stats, ignored))
+            {
+                cout<<"Could not read shot journal "<<argv[a]<<endl;
+                exit(1);
+            }
+            shot_journal_print(stats);
+            if(ignored)
+                printf("Ignored %zu bytes after the last intact block\n", ignored);
+            printf("Aggregated in %.0f ms\n", elapsed_ms(begin));
+            exit(0);
+        }
+        else if(strcmp(argv[a], "--frame-budget") == 0 && a+1 < argc)
+            dyn_res.budget_ms = atof(argv[++a]);
+        else if(strcmp(argv[a], "--particles") == 0 && a+1 < argc)
+            particle_capacity = atoi(argv[++a]);
+        else if(strcmp(argv[a], "--rewind-seconds") == 0 && a+1 < argc)
+        {
+            rewind_seconds = max(1, atoi(argv[++a]));
+            rewind_buffer = RewindBuffer(REWIND_BUDGET_BYTES, rewind_seconds*60, REWIND_KEYFRAME_INTERVAL);
+        }
+        else if(strcmp(argv[a], "--stress") == 0)
+            stress.active = true;
+        else if(strcmp(argv[a], "--job-threads") == 0 && a+1 < argc)
+            job_threads = max(1, atoi(argv[++a]));
+        else if(strcmp(argv[a], "--bench-jobs") == 0 && a+1 < argc)
+        {
+            bench_jobs(max(1, atoi(argv[++a])));
+            exit(0);
+        }
+        else if(strcmp(argv[a], "--headless") == 0)
+            headless = true;
+        else if(strcmp(argv[a], "--gl-check") == 0)
+        {
+            if(!gl_trace_enable_check())
+                cout<<"--gl-check needs a build with -DGL_TRACE"<<endl;
+        }
+        else if(strcmp(argv[a], "--trace") == 0 && a+1 < argc)
+        {
+            trace_path = argv[++a];
+            tracer.enable();
+        }
+        else if(strcmp(argv[a], "--frames") == 0 && a+1 < argc)
+            headless_frames = max(1, atoi(argv[++a]));
+        else if(strcmp(argv[a], "--world") == 0 && a+1 < argc)
+            world_chunks = max(0, atoi(argv[++a]));
+        else if(strcmp(argv[a], "--world-budget") == 0 && a+1 < argc)
+            world_budget = (size_t)max(1, atoi(argv[++a]))*1024;
+        else if(strcmp(argv[a], "--bench-env") == 0 && a+1 < argc)
+        {
+            bench_env(atoi(argv[++a]));
+            exit(0);
+        }
+    }
+    // the stress levels outgrow the fixed-point sim's coins and the world is not in it, both run on the float physics
+    if((stress.active || world_chunks > 0) && deterministic_physics)
+    {
+        const char* option = stress.active ? "--stress" : "--world";
+        if(hash_log)
+        {
+            cout<<"--hash-log needs the deterministic physics, which "<<option<<" does not run on"<<endl;
+            exit(1);
+        }
+        cout<<"Deterministic physics is off with "<<option<<", the float physics runs instead"<<endl;
+        deterministic_physics = false;
+    }
+}
 
 int main (int argc, char** argv)
 {
 	int width = 600;
 	int height = 600;
 
-    initGLUT (argc, argv, width, height);
-
-    addGLUTMenus ();
+    parse_args (argc, argv);
+    startup_begin = chrono::steady_clock::now();
+    if(tracer.enabled())
+        tracer.name_thread("main");
+    if(headless)
+        renderer = &null_renderer;
+    else
+    {
+        initGLUT (argc, argv, width, height);
+        addGLUTMenus ();
+        renderer = &gl_renderer;
+    }
 
-	initGL (width, height);
+	renderer->init (width, height);
+	init_game (width, height);
 
+    if(headless)
+        run_headless ();
     glutMainLoop ();
 
     return 0;
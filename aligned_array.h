@@ -0,0 +1,68 @@
+#ifndef ALIGNED_ARRAY_H
+#define ALIGNED_ARRAY_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <type_traits>
+
+/****************************************
+ * Growable aligned arrays              *
+ ****************************************/
+/* A resizable array of plain data whose storage starts on a cache line, for the per-coin
+   values the hot loops walk. Growing copies the bytes over and zeroes the new elements,
+   capacity doubles so adding a level of coins at a time stays cheap */
+
+#define CACHE_LINE_BYTES 64
+
+template <typename T>
+class AlignedArray {
+    static_assert(std::is_trivially_copyable<T>::value, "AlignedArray only holds plain data");
+public:
+    AlignedArray () : data_(NULL), size_(0), capacity_(0) {}
+    ~AlignedArray () { free(data_); }
+
+    AlignedArray (const AlignedArray&) = delete;
+    AlignedArray& operator= (const AlignedArray&) = delete;
+
+    /* Grows or shrinks to 'size' elements, new ones are zero */
+    void resize (size_t size)
+    {
+        if(size > capacity_)
+            reserve(std::max(size, capacity_*2));
+        if(size > size_)
+            memset(data_ + size_, 0, (size - size_)*sizeof(T));
+        size_ = size;
+    }
+
+    void reserve (size_t capacity)
+    {
+        if(capacity <= capacity_)
+            return;
+        size_t bytes = (capacity*sizeof(T) + CACHE_LINE_BYTES-1) & ~(size_t)(CACHE_LINE_BYTES-1);
+        T* data = (T*) aligned_alloc(CACHE_LINE_BYTES, bytes);
+        if(data == NULL)
+            abort();
+        if(size_)
+            memcpy(data, data_, size_*sizeof(T));
+        free(data_);
+        data_ = data;
+        capacity_ = bytes/sizeof(T);
+    }
+
+    T& operator[] (size_t i) { return data_[i]; }
+    const T& operator[] (size_t i) const { return data_[i]; }
+
+    T* data () { return data_; }
+    const T* data () const { return data_; }
+    size_t size () const { return size_; }
+    size_t capacity () const { return capacity_; }
+    size_t bytes () const { return capacity_*sizeof(T); }
+
+private:
+    T* data_;
+    size_t size_;
+    size_t capacity_;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+/****************************************
+ * Oriented box collision               *
+ ****************************************/
+/* Obstacles are oriented boxes placed like the blocks are drawn: a local rectangle, rotated
+   about and moved to a pivot. They are kept as a structure of arrays so the narrow phase is
+   a straight loop over every obstacle. For a circle against a box the separating axes are
+   the two box axes and the axis from the closest box point to the centre, clamping the
+   centre into the box finds that point directly */
+
+enum ObstacleFlags { OBSTACLE_SOLID = 1, OBSTACLE_HAZARD = 2 };
+
+struct ObstacleSet {
+    std::vector<float> cx, cy;          // box centre
+    std::vector<float> hx, hy;          // half extents along the box axes
+    std::vector<float> cosr, sinr;      // box rotation
+    std::vector<float> px, py;          // pivot the box turns about
+    std::vector<float> vx, vy;          // velocity of the pivot
+    std::vector<float> spin;            // angular velocity, radians per second
+    std::vector<float> ex, ey;          // tangential and normal damping, velocities are divided by them
+    std::vector<int> flags;
+    std::vector<float> scratch;         // squared distances of the last query
+};
+typedef struct ObstacleSet ObstacleSet;
+
+struct CircleContact {
+    int obstacle;
+    float nx, ny;       // unit normal from the obstacle towards the circle
+    float depth;        // overlap along the normal
+    float x, y;         // contact point on the obstacle surface
+};
+typedef struct CircleContact CircleContact;
+
+/* Adds an obstacle, place it with obstacle_place before use */
+inline int obstacle_add (ObstacleSet& set, int flags, float ex, float ey)
+{
+    set.cx.push_back(0); set.cy.push_back(0);
+    set.hx.push_back(0); set.hy.push_back(0);
+    set.cosr.push_back(1); set.sinr.push_back(0);
+    set.px.push_back(0); set.py.push_back(0);
+    set.vx.push_back(0); set.vy.push_back(0);
+    set.spin.push_back(0);
+    set.ex.push_back(ex); set.ey.push_back(ey);
+    set.flags.push_back(flags);
+    set.scratch.push_back(0);
+    return set.flags.size() - 1;
+}
+
+/* Puts the local rectangle (x0,y0)-(x1,y1) at pivot (pivot_x,pivot_y) rotated by 'angle'
+   radians, the same transform draw() builds for a block */
+inline void obstacle_place (ObstacleSet& set, int o, float pivot_x, float pivot_y, float angle,
+                            float x0, float y0, float x1, float y1, float vx, float vy, float spin)
+{
+    float c = cosf(angle), s = sinf(angle);
+    float mx = 0.5f*(x0 + x1), my = 0.5f*(y0 + y1);
+    set.cx[o] = pivot_x + c*mx - s*my;
+    set.cy[o] = pivot_y + s*mx + c*my;
+    set.hx[o] = 0.5f*fabsf(x1 - x0);
+    set.hy[o] = 0.5f*fabsf(y1 - y0);
+    set.cosr[o] = c;
+    set.sinr[o] = s;
+    set.px[o] = pivot_x;
+    set.py[o] = pivot_y;
+    set.vx[o] = vx;
+    set.vy[o] = vy;
+    set.spin[o] = spin;
+}
+
+/* Appends a contact for every obstacle with matching flags that overlaps the circle,
+   deepest first. Returns the number of contacts */
+inline int collide_circle (ObstacleSet& set, float x, float y, float radius, int flags, std::vector<CircleContact>& contacts)
+{
+    contacts.clear();
+    int n = set.flags.size();
+    const float *cx = &set.cx[0], *cy = &set.cy[0], *hx = &set.hx[0], *hy = &set.hy[0];
+    const float *c = &set.cosr[0], *s = &set.sinr[0];
+    float* d2 = &set.scratch[0];
+
+    // distance from the centre to the closest point of every box, branch free
+    for(int o=0; o<n; o++)
+    {
+        float dx = x - cx[o], dy = y - cy[o];
+        float lx = dx*c[o] + dy*s[o];
+        float ly = -dx*s[o] + dy*c[o];
+        float qx = std::min(std::max(lx, -hx[o]), hx[o]);
+        float qy = std::min(std::max(ly, -hy[o]), hy[o]);
+        d2[o] = (lx - qx)*(lx - qx) + (ly - qy)*(ly - qy);
+    }
+
+    for(int o=0; o<n; o++)
+    {
+        if(d2[o] >= radius*radius || (set.flags[o] & flags) == 0)
+            continue;
+        float dx = x - cx[o], dy = y - cy[o];
+        float lx = dx*c[o] + dy*s[o];
+        float ly = -dx*s[o] + dy*c[o];
+        float nlx, nly, depth, qx, qy;
+        if(d2[o] > 1e-12f)
+        {
+            qx = std::min(std::max(lx, -hx[o]), hx[o]);
+            qy = std::min(std::max(ly, -hy[o]), hy[o]);
+            float d = sqrtf(d2[o]);
+            nlx = (lx - qx)/d;
+            nly = (ly - qy)/d;
+            depth = radius - d;
+        }
+        else
+        {
+            // centre inside the box, leave through the nearest face
+            float px = hx[o] - fabsf(lx), py = hy[o] - fabsf(ly);
+            if(px < py)
+            {
+                nlx = lx < 0 ? -1 : 1; nly = 0;
+                qx = nlx*hx[o]; qy = ly;
+                depth = radius + px;
+            }
+            else
+            {
+                nlx = 0; nly = ly < 0 ? -1 : 1;
+                qx = lx; qy = nly*hy[o];
+                depth = radius + py;
+            }
+        }
+        CircleContact contact;
+        contact.obstacle = o;
+        contact.nx = nlx*c[o] - nly*s[o];
+        contact.ny = nlx*s[o] + nly*c[o];
+        contact.depth = depth;
+        contact.x = cx[o] + qx*c[o] - qy*s[o];
+        contact.y = cy[o] + qx*s[o] + qy*c[o];
+        contacts.push_back(contact);
+    }
+    std::sort(contacts.begin(), contacts.end(),
+              [](const CircleContact& a, const CircleContact& b) { return a.depth > b.depth; });
+    return contacts.size();
+}
+
+/* Whether a circle moving from (x,y) by (dx,dy) comes within 'reach' of the point (px,py),
+   a capsule test. 't' is the share of the move done when it first does, 0 if it starts there */
+inline bool sweep_circle_point (float x, float y, float dx, float dy, float px, float py, float reach, float& t)
+{
+    float fx = x - px, fy = y - py;
+    float c = fx*fx + fy*fy - reach*reach;
+    if(c <= 0)
+    {
+        t = 0;
+        return true;
+    }
+    float a = dx*dx + dy*dy;
+    float b = fx*dx + fy*dy;
+    // standing still or moving away
+    if(a <= 0 || b >= 0)
+        return false;
+    float disc = b*b - a*c;
+    if(disc < 0)
+        return false;
+    t = (-b - sqrtf(disc))/a;
+    return t <= 1;
+}
+
+/* Velocity of the obstacle surface at the contact point, spin included */
+inline void obstacle_surface_velocity (const ObstacleSet& set, const CircleContact& contact, float& vx, float& vy)
+{
+    int o = contact.obstacle;
+    vx = set.vx[o] - set.spin[o]*(contact.y - set.py[o]);
+    vy = set.vy[o] + set.spin[o]*(contact.x - set.px[o]);
+}
+
+/* Bounces the circle velocity (vx,vy) off the contact relative to the moving surface: the
+   normal part is reversed and divided by ey, the tangential part divided by ex. A rebound
+   slower than rest_speed is dropped so a resting circle stays in contact and keeps sliding
+   to a stop. Returns false and leaves the velocity alone when the circle is already separating */
+inline bool contact_response (const ObstacleSet& set, const CircleContact& contact, float& vx, float& vy, float rest_speed=0)
+{
+    float sx, sy;
+    obstacle_surface_velocity(set, contact, sx, sy);
+    float rx = vx - sx, ry = vy - sy;
+    float vn = rx*contact.nx + ry*contact.ny;
+    if(vn >= 0)
+        return false;
+    float tx = rx - vn*contact.nx, ty = ry - vn*contact.ny;
+    float ex = set.ex[contact.obstacle], ey = set.ey[contact.obstacle];
+    float rebound = -vn/ey;
+    if(rebound < rest_speed)
+        rebound = 0;
+    vx = sx + rebound*contact.nx + tx/ex;
+    vy = sy + rebound*contact.ny + ty/ex;
+    return true;
+}
+
+#endif
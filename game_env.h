@@ -0,0 +1,249 @@
+#ifndef GAME_ENV_H
+#define GAME_ENV_H
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+#include "game_sim.h"
+
+/****************************************
+ * Headless environment                 *
+ ****************************************/
+/* The game as an environment for aiming agents and automated playtests. Each
+   instance owns its own SimState, no GL context or global state is touched */
+
+/* Aim the canon and optionally fire, firing while the ball flies restarts the shot like in the game */
+struct EnvAction {
+    float aim;      // canon rotation in degrees
+    float power;    // shooting power, same scale as power_meter
+    bool shoot;
+};
+typedef struct EnvAction EnvAction;
+
+struct EnvObservation {
+    std::vector<float> coin_x;              // coins of the current level
+    std::vector<float> coin_y;
+    std::vector<unsigned char> coin_alive;
+    float ball_x, ball_y;
+    float ball_vx, ball_vy;
+    bool ball_flying;
+    float trap_x, trap_y;                   // centre of the trappy box
+    int score;
+    int level;
+};
+typedef struct EnvObservation EnvObservation;
+
+struct EnvStep {
+    int events;     // SimEvent bits raised during the step
+    int reward;     // coins collected during the step
+    bool done;      // trapped or game complete, the instance has to be reset
+};
+typedef struct EnvStep EnvStep;
+
+class GameEnv {
+public:
+    GameEnv () : done_(false) { sim_reset(state_, 0); }
+
+    void reset (uint64_t seed)
+    {
+        sim_reset(state_, seed);
+        done_ = false;
+    }
+
+    /* Applies the action and advances the physics by one tick */
+    EnvStep step (const EnvAction& action)
+    {
+        EnvStep result = { 0, 0, done_ };
+        if(done_)
+            return result;
+        if(action.shoot)
+            sim_shoot(state_, FX(action.aim), FX(action.power));
+        int score = state_.score;
+        result.events = sim_tick(state_);
+        result.reward = state_.score - score;
+        done_ = (result.events & (SIM_TRAPPED | SIM_GAME_COMPLETE)) != 0;
+        result.done = done_;
+        return result;
+    }
+
+    void observe (EnvObservation& obs) const
+    {
+        int coins = std::min(state_.num_coin, max_coins);
+        obs.coin_x.resize(coins);
+        obs.coin_y.resize(coins);
+        obs.coin_alive.resize(coins);
+        for(int r=1;r<=coins;r++)
+        {
+            obs.coin_x[r-1] = fx_to_double(state_.coin_x[r]);
+            obs.coin_y[r-1] = fx_to_double(state_.coin_y[r]);
+            obs.coin_alive[r-1] = state_.coin_alive[r];
+        }
+        obs.ball_x = fx_to_double(sim_ball_x(state_));
+        obs.ball_y = fx_to_double(sim_ball_y(state_));
+        obs.ball_vx = fx_to_double(state_.vx);
+        obs.ball_vy = fx_to_double(state_.vy);
+        obs.ball_flying = state_.shoot;
+        obs.trap_x = fx_to_double(sim_layout.trap.x0 + sim_layout.trap.x1)/2;
+        obs.trap_y = fx_to_double(sim_layout.trap.y0 + sim_layout.trap.y1)/2 + fx_to_double(state_.trappy);
+        obs.score = state_.score;
+        obs.level = state_.level;
+    }
+
+    bool done () const { return done_; }
+    const SimState& state () const { return state_; }
+
+private:
+    SimState state_;
+    bool done_;
+};
+
+/* Fixed set of worker threads that run batches of indexed tasks, the calling
+   thread takes part in every batch */
+class ThreadPool {
+public:
+    explicit ThreadPool (int threads) : job_(NULL), count_(0), next_(0), busy_(0), generation_(0), stop_(false)
+    {
+        for(int t=1;t<threads;t++)
+            workers_.push_back(std::thread(&ThreadPool::worker, this));
+    }
+
+    ~ThreadPool ()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for(size_t t=0;t<workers_.size();t++)
+            workers_[t].join();
+    }
+
+    ThreadPool (const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    int size () const { return workers_.size() + 1; }
+
+    /* Runs fn(0) .. fn(count-1) and returns once all of them are done */
+    void run (int count, const std::function<void(int)>& fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &fn;
+            count_ = count;
+            next_ = 0;
+            busy_ = workers_.size();
+            generation_++;
+        }
+        wake_.notify_all();
+        drain(fn, count);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [this] { return busy_ == 0; });
+        job_ = NULL;
+    }
+
+private:
+    void drain (const std::function<void(int)>& fn, int count)
+    {
+        for(int task = next_++; task < count; task = next_++)
+            fn(task);
+    }
+
+    void worker ()
+    {
+        uint64_t seen = 0;
+        while(true)
+        {
+            const std::function<void(int)>* job;
+            int count;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+                if(stop_)
+                    return;
+                seen = generation_;
+                job = job_;
+                count = count_;
+            }
+            drain(*job, count);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                busy_--;
+            }
+            finished_.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_, finished_;
+    const std::function<void(int)>* job_;
+    int count_;
+    std::atomic<int> next_;
+    int busy_;
+    uint64_t generation_;
+    bool stop_;
+};
+
+/* N independent games stepped together on a thread pool. Finished instances are
+   reset on the spot with a seed that only depends on the instance and episode, so
+   results do not depend on the number of threads */
+class VectorEnv {
+public:
+    VectorEnv (int num_envs, int threads, uint64_t seed) : envs_(num_envs), episodes_(num_envs, 0), pool_(threads)
+    {
+        reset(seed);
+    }
+
+    void reset (uint64_t seed)
+    {
+        seed_ = seed;
+        for(size_t e=0;e<envs_.size();e++)
+        {
+            episodes_[e] = 0;
+            envs_[e].reset(episode_seed(e));
+        }
+    }
+
+    /* Steps every instance once, actions and results are indexed by instance */
+    void step (const std::vector<EnvAction>& actions, std::vector<EnvStep>& results)
+    {
+        int n = envs_.size();
+        results.resize(n);
+        int tasks = (n + envs_per_task - 1) / envs_per_task;
+        pool_.run(tasks, [&](int task) {
+            int last = std::min(n, (task+1)*envs_per_task);
+            for(int e=task*envs_per_task;e<last;e++)
+            {
+                results[e] = envs_[e].step(actions[e]);
+                if(results[e].done)
+                {
+                    episodes_[e]++;
+                    envs_[e].reset(episode_seed(e));
+                }
+            }
+        });
+    }
+
+    void observe (int env, EnvObservation& obs) const { envs_[env].observe(obs); }
+    const GameEnv& env (int e) const { return envs_[e]; }
+    int size () const { return envs_.size(); }
+    int threads () const { return pool_.size(); }
+
+private:
+    static const int envs_per_task = 64;
+
+    uint64_t episode_seed (size_t e) const { return seed_ + e + episodes_[e]*(uint64_t)envs_.size(); }
+
+    std::vector<GameEnv> envs_;
+    std::vector<uint64_t> episodes_;
+    ThreadPool pool_;
+    uint64_t seed_;
+};
+
+#endif
@@ -0,0 +1,477 @@
+#ifndef GAME_SIM_H
+#define GAME_SIM_H
+
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+
+/****************************************
+ * Deterministic fixed-point physics    *
+ ****************************************/
+/* The game physics on a self-contained state, free of GL and of globals, so it can
+   run headless and in many instances at once. It uses integer maths only (Q16.16
+   fixed point), so a run gives bit-identical results with any compiler or CPU.
+   The state is hashed after every tick so that two runs can be compared step by step */
+
+const int max_coins = 490;
+
+typedef int64_t fixed_t;
+#define FX_ONE ((fixed_t)1 << 16)
+
+constexpr fixed_t FX (double d) { return (fixed_t)(d*FX_ONE + (d >= 0 ? 0.5 : -0.5)); }
+inline double fx_to_double (fixed_t a) { return (double)a / FX_ONE; }
+// division rounds towards zero everywhere, unlike >> on negative numbers
+inline fixed_t fx_mul (fixed_t a, fixed_t b) { return a*b / FX_ONE; }
+inline fixed_t fx_div (fixed_t a, fixed_t b) { return b == 0 ? a : a*FX_ONE / b; }
+inline fixed_t fx_clamp (fixed_t a, fixed_t lo, fixed_t hi) { return a < lo ? lo : a > hi ? hi : a; }
+
+/* Square root of a non-negative fixed point number, bit by bit */
+inline fixed_t fx_sqrt (fixed_t a)
+{
+    if(a <= 0)
+        return 0;
+    uint64_t op = (uint64_t)a << 16, res = 0, one = (uint64_t)1 << 62;
+    while(one > op)
+        one >>= 2;
+    while(one != 0)
+    {
+        if(op >= res + one)
+        {
+            op -= res + one;
+            res += one << 1;
+        }
+        res >>= 1;
+        one >>= 2;
+    }
+    return (fixed_t)res;
+}
+
+/* sin and cos of an angle in degrees, Taylor series on [0,45] after range reduction */
+inline void fx_sincos_deg (fixed_t deg, fixed_t& s, fixed_t& c)
+{
+    deg %= FX(360);
+    if(deg < 0)
+        deg += FX(360);
+    int quadrant = deg / FX(90);
+    fixed_t a = deg - quadrant*FX(90);
+    bool swapped = a > FX(45);
+    if(swapped)
+        a = FX(90) - a;
+    fixed_t x = fx_mul(a, FX(M_PI/180));
+    fixed_t x2 = fx_mul(x, x);
+    fixed_t sn = fx_mul(x, FX_ONE - fx_mul(x2, FX(1.0/6) - fx_mul(x2, FX(1.0/120) - fx_mul(x2, FX(1.0/5040)))));
+    fixed_t cs = FX_ONE - fx_mul(x2, FX(0.5) - fx_mul(x2, FX(1.0/24) - fx_mul(x2, FX(1.0/720) - fx_mul(x2, FX(1.0/40320)))));
+    if(swapped)
+    {
+        fixed_t t = sn; sn = cs; cs = t;
+    }
+    switch(quadrant)
+    {
+        case 0: s = sn; c = cs; break;
+        case 1: s = cs; c = -sn; break;
+        case 2: s = -sn; c = -cs; break;
+        default: s = -cs; c = sn; break;
+    }
+}
+
+/* Everything the physics of one game touches, coins are indexed from 1 like the globals */
+struct SimState {
+    bool shoot;
+    fixed_t o;
+    fixed_t ux, uy, vx, vy;
+    fixed_t newx, newy;
+    fixed_t collisionx, collisiony;
+    fixed_t ex, ey;
+    fixed_t energy;
+    fixed_t trappy, trappy_dir;
+    int score;
+    int level;
+    int num_coin;
+    std::vector<fixed_t> coin_x;
+    std::vector<fixed_t> coin_y;
+    std::vector<unsigned char> coin_alive;
+    uint64_t tick;
+    uint64_t rng;
+};
+typedef struct SimState SimState;
+
+/* Events reported by sim_tick */
+enum SimEvent {
+    SIM_COIN_COLLECTED = 1,
+    SIM_LEVEL_UP = 2,
+    SIM_TRAPPED = 4,
+    SIM_GAME_COMPLETE = 8,
+    SIM_BOUNCED = 16
+};
+
+const fixed_t fx_radius_object = FX(0.30);
+const fixed_t fx_radius_coins = FX(0.10);
+const fixed_t fx_gravity = FX(-10);
+const fixed_t fx_time_step = FX(0.01);
+
+/* The level's blocks the way draw() places them, a local rectangle at a pivot, with the
+   tangential and normal damping the ball gets off them. The float physics turns them by the
+   block rotations and the meshes are drawn from them, the fixed-point physics keeps them at
+   the angle 0 they never leave */
+struct LevelBlock {
+    double pivot_x, pivot_y;
+    double x0, y0, x1, y1;
+    double ex, ey;
+};
+typedef struct LevelBlock LevelBlock;
+
+enum LevelBlockIndex { LEVEL_LEFT, LEVEL_RIGHT, LEVEL_ROUGH, LEVEL_GROUND, NUM_LEVEL_BLOCKS };
+
+constexpr LevelBlock level_blocks[NUM_LEVEL_BLOCKS] = {
+    { -1.7, 2, 0, 0, 1.2, 0.2, 1.2, 1.2 },          // left-most rectangle
+    { 2.4, 2, 0, 0, 1.2, 0.2, 1.2, 1.2 },           // right-most rectangle
+    { 0.7, -3.2, 0, 0, 1.2, 0.2, 3.0, 2.1 },        // rough-ground rectangle
+    { -1.7, -3.4, -180, -10, 170, 0.2, 1.2, 1.5 }   // ground
+};
+// the trappy box, its pivot moves up by trappy
+constexpr LevelBlock level_trap = { 2, 0, 0.4, 0.3, 0.8, 0.7, 1, 1 };
+
+/* A level block in world units at angle 0 */
+struct SimBox {
+    fixed_t x0, y0, x1, y1;
+    fixed_t ex, ey;
+};
+typedef struct SimBox SimBox;
+
+constexpr SimBox sim_box (const LevelBlock& b)
+{
+    return SimBox{ FX(b.pivot_x + b.x0), FX(b.pivot_y + b.y0), FX(b.pivot_x + b.x1), FX(b.pivot_y + b.y1), FX(b.ex), FX(b.ey) };
+}
+
+/* Static level layout the physics works against, in world units */
+struct SimLayout {
+    SimBox blocks[NUM_LEVEL_BLOCKS];
+    SimBox trap;                        // where the trappy box is when trappy is 0
+    fixed_t trap_min, trap_max;         // range of trappy
+    int coin_grid_x0, coin_grid_w;      // coins sit on a 0.1 unit grid, in tenths
+    int coin_grid_y0, coin_grid_h;
+};
+typedef struct SimLayout SimLayout;
+
+const SimLayout sim_layout = {
+    { sim_box(level_blocks[LEVEL_LEFT]), sim_box(level_blocks[LEVEL_RIGHT]),
+      sim_box(level_blocks[LEVEL_ROUGH]), sim_box(level_blocks[LEVEL_GROUND]) },
+    sim_box(level_trap),
+    FX(-2.5), FX(0.5),
+    -39, 78,
+    -30, 60
+};
+
+/* FNV-1a step, values are fed byte by byte so endianness does not matter */
+inline void fnv_mix (uint64_t& h, int64_t value)
+{
+    for(int b=0;b<8;b++)
+    {
+        h ^= ((uint64_t)value >> (8*b)) & 0xff;
+        h *= 1099511628211ULL;
+    }
+}
+
+/* Hash of everything that decides where a shot goes and where coins can be */
+inline uint64_t sim_layout_hash ()
+{
+    const SimLayout& l = sim_layout;
+    int64_t values[] = { l.trap_min, l.trap_max,
+                         l.coin_grid_x0, l.coin_grid_w, l.coin_grid_y0, l.coin_grid_h,
+                         fx_radius_object, fx_radius_coins, fx_gravity, fx_time_step };
+    uint64_t h = 14695981039346656037ULL;
+    for(int b=0;b<=NUM_LEVEL_BLOCKS;b++)
+    {
+        const SimBox& box = b < NUM_LEVEL_BLOCKS ? l.blocks[b] : l.trap;
+        int64_t sides[] = { box.x0, box.y0, box.x1, box.y1, box.ex, box.ey };
+        for(int v=0;v<6;v++)
+            fnv_mix(h, sides[v]);
+    }
+    for(size_t v=0;v<sizeof(values)/sizeof(values[0]);v++)
+        fnv_mix(h, values[v]);
+    return h;
+}
+
+/* splitmix64, the same sequence on every platform unlike rand() */
+inline uint64_t sim_random (SimState& s)
+{
+    uint64_t z = (s.rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+inline void sim_reset (SimState& s, uint64_t seed)
+{
+    s.shoot = false;
+    s.o = 0;
+    s.ux = s.uy = s.vx = s.vy = 0;
+    s.newx = s.newy = 0;
+    s.collisionx = s.collisiony = 0;
+    // the float path starts these at 0 and divides by them, start from no friction instead
+    s.ex = s.ey = FX_ONE;
+    s.energy = 0;
+    s.trappy = 0;
+    s.trappy_dir = FX_ONE;
+    s.score = 0;
+    s.level = 1;
+    s.num_coin = 6;
+    s.tick = 0;
+    s.rng = seed;
+    s.coin_x.assign(max_coins+1, 0);
+    s.coin_y.assign(max_coins+1, 0);
+    s.coin_alive.assign(max_coins+1, 0);
+    for(int r=1;r<=max_coins;r++)
+    {
+        s.coin_x[r] = ((fixed_t)(sim_random(s)%sim_layout.coin_grid_w) + sim_layout.coin_grid_x0) * FX_ONE / 10;
+        s.coin_y[r] = ((fixed_t)(sim_random(s)%sim_layout.coin_grid_h) + sim_layout.coin_grid_y0) * FX_ONE / 10;
+        s.coin_alive[r] = 1;
+    }
+}
+
+inline void sim_shoot (SimState& s, fixed_t rotation_deg, fixed_t power)
+{
+    fixed_t sn, cs;
+    fx_sincos_deg(rotation_deg, sn, cs);
+    s.shoot = true;
+    s.collisionx = s.collisiony = 0;
+    s.newx = s.newy = 0;
+    s.ux = fx_mul(power, cs);
+    s.uy = fx_mul(power, sn);
+    s.vx = s.vy = 0;
+    s.o = 0;
+}
+
+/* ball position in world units, the canon stands at (-3,-3) */
+inline fixed_t sim_ball_x (const SimState& s) { return s.collisionx + s.newx - FX(3); }
+inline fixed_t sim_ball_y (const SimState& s) { return s.collisiony + s.newy - FX(3); }
+
+inline bool sim_in_range (fixed_t v, fixed_t lo, fixed_t hi) { return v >= lo && v <= hi; }
+
+inline void sim_move (SimState& s)
+{
+    if(!s.shoot)
+        return;
+    s.vx = s.ux;
+    s.vy = s.uy + fx_mul(fx_gravity, s.o);
+    s.energy = fx_sqrt(fx_mul(s.vx, s.vx) + fx_mul(s.vy, s.vy));
+    s.newx = fx_mul(s.ux, s.o);
+    s.newy = fx_mul(s.uy, s.o) + fx_mul(fx_mul(fx_gravity, s.o), s.o) / 2;
+}
+
+/* sweep_circle_point of collision.h in fixed point: whether the ball moving from (x,y) by
+   (dx,dy) comes within 'reach' of (px,py), 't' is the share of the move done when it first does */
+inline bool sim_sweep_point (fixed_t x, fixed_t y, fixed_t dx, fixed_t dy, fixed_t px, fixed_t py, fixed_t reach, fixed_t& t)
+{
+    fixed_t fx = x - px, fy = y - py;
+    fixed_t c = fx_mul(fx, fx) + fx_mul(fy, fy) - fx_mul(reach, reach);
+    if(c <= 0)
+    {
+        t = 0;
+        return true;
+    }
+    fixed_t a = fx_mul(dx, dx) + fx_mul(dy, dy);
+    fixed_t b = fx_mul(fx, dx) + fx_mul(fy, dy);
+    // standing still or moving away
+    if(a <= 0 || b >= 0)
+        return false;
+    fixed_t disc = fx_mul(b, b) - fx_mul(a, c);
+    if(disc < 0)
+        return false;
+    t = fx_div(-b - fx_sqrt(disc), a);
+    return t <= FX_ONE;
+}
+
+/* Collects every coin the ball touched moving from (x0,y0) to where it is now, in the order it
+   touched them like collect_coins does, so a fast ball takes the coins it flies past. Coins a
+   level up adds come into play on the next tick */
+inline int sim_collect_coins (SimState& s, fixed_t x0, fixed_t y0)
+{
+    fixed_t dx = sim_ball_x(s) - x0, dy = sim_ball_y(s) - y0;
+    fixed_t reach = fx_radius_coins + fx_radius_object;
+    int last = s.num_coin < max_coins ? s.num_coin : max_coins;
+    int events = 0;
+    for(;;)
+    {
+        // the first coin touched still in play, ties go to the lower numbered coin
+        int first = 0;
+        fixed_t first_t = 0;
+        for(int r=1;r<=last;r++)
+        {
+            fixed_t t;
+            if(s.coin_alive[r] && sim_sweep_point(x0, y0, dx, dy, s.coin_x[r], s.coin_y[r], reach, t) &&
+               (first == 0 || t < first_t))
+            {
+                first = r;
+                first_t = t;
+            }
+        }
+        if(first == 0)
+            return events;
+        events |= SIM_COIN_COLLECTED;
+        s.score++;
+        if(s.score % s.num_coin == 0)
+        {
+            s.num_coin += 12;
+            s.level++;
+            events |= SIM_LEVEL_UP;
+        }
+        if(s.num_coin > 499)
+            events |= SIM_GAME_COMPLETE;
+        s.coin_alive[first] = 0;
+    }
+}
+
+/* Contact of the ball with a box, as collide_circle in collision.h finds it */
+struct SimContact {
+    int box;
+    fixed_t nx, ny;     // unit normal from the box towards the ball
+    fixed_t depth;
+};
+typedef struct SimContact SimContact;
+
+/* Whether a ball at (x,y) overlaps the box, the closest box point gives the normal unless the
+   centre is inside, then it leaves through the nearest face */
+inline bool sim_box_contact (const SimBox& b, fixed_t x, fixed_t y, fixed_t radius, SimContact& contact)
+{
+    fixed_t qx = fx_clamp(x, b.x0, b.x1);
+    fixed_t qy = fx_clamp(y, b.y0, b.y1);
+    fixed_t dx = x - qx, dy = y - qy;
+    fixed_t d2 = fx_mul(dx, dx) + fx_mul(dy, dy);
+    if(d2 >= fx_mul(radius, radius))
+        return false;
+    fixed_t d = fx_sqrt(d2);
+    if(d > 0)
+    {
+        contact.nx = fx_div(dx, d);
+        contact.ny = fx_div(dy, d);
+        contact.depth = radius - d;
+        return true;
+    }
+    fixed_t lx = x - (b.x0 + b.x1)/2, ly = y - (b.y0 + b.y1)/2;
+    fixed_t px = (b.x1 - b.x0)/2 - (lx < 0 ? -lx : lx);
+    fixed_t py = (b.y1 - b.y0)/2 - (ly < 0 ? -ly : ly);
+    if(px < py)
+    {
+        contact.nx = lx < 0 ? -FX_ONE : FX_ONE;
+        contact.ny = 0;
+        contact.depth = radius + px;
+    }
+    else
+    {
+        contact.nx = 0;
+        contact.ny = ly < 0 ? -FX_ONE : FX_ONE;
+        contact.depth = radius + py;
+    }
+    return true;
+}
+
+/* The float collision_func in fixed point: push out of every block the ball overlaps, deepest
+   first, bounce off those it moves into and take their damping. Blocks stand still */
+inline int sim_collision (SimState& s)
+{
+    if(!s.shoot)
+        return 0;
+    const SimLayout& l = sim_layout;
+    fixed_t x = sim_ball_x(s), y = sim_ball_y(s);
+    // slower than two ticks of gravity off a surface and the ball settles on it instead of bouncing
+    fixed_t rest_speed = -2*fx_mul(fx_gravity, fx_time_step);
+    SimContact contacts[NUM_LEVEL_BLOCKS];
+    int n = 0;
+    for(int b=0;b<NUM_LEVEL_BLOCKS;b++)
+        if(sim_box_contact(l.blocks[b], x, y, fx_radius_object, contacts[n]))
+            contacts[n++].box = b;
+    // deepest first, ties by box, an insertion sort as there are four contacts at most
+    for(int c=1;c<n;c++)
+    {
+        SimContact contact = contacts[c];
+        int d = c;
+        for(; d>0 && (contacts[d-1].depth < contact.depth ||
+                      (contacts[d-1].depth == contact.depth && contacts[d-1].box > contact.box)); d--)
+            contacts[d] = contacts[d-1];
+        contacts[d] = contact;
+    }
+
+    int events = 0;
+    fixed_t vx = s.vx, vy = s.vy, pushx = 0, pushy = 0;
+    for(int c=0;c<n;c++)
+    {
+        const SimContact& contact = contacts[c];
+        const SimBox& box = l.blocks[contact.box];
+        pushx += fx_mul(contact.nx, contact.depth);
+        pushy += fx_mul(contact.ny, contact.depth);
+        // contact_response off a surface that stands still
+        fixed_t vn = fx_mul(vx, contact.nx) + fx_mul(vy, contact.ny);
+        if(vn >= 0)
+            continue;
+        fixed_t tx = vx - fx_mul(vn, contact.nx), ty = vy - fx_mul(vn, contact.ny);
+        fixed_t rebound = fx_div(-vn, box.ey);
+        if(rebound < rest_speed)
+            rebound = 0;
+        else
+            events |= SIM_BOUNCED;
+        vx = fx_mul(rebound, contact.nx) + fx_div(tx, box.ex);
+        vy = fx_mul(rebound, contact.ny) + fx_div(ty, box.ex);
+        s.ex = box.ex;
+        s.ey = box.ey;
+    }
+    if(n > 0)
+    {
+        s.ux = s.vx = vx;
+        s.uy = s.vy = vy;
+        s.collisionx += s.newx + pushx;
+        s.collisiony += s.newy + pushy;
+        s.newx = s.newy = 0;
+        s.o = 0;
+    }
+
+    if(sim_in_range(s.vx, -FX(0.01), FX(0.01)) && sim_in_range(s.vy, -FX(0.01), FX(0.01)))
+        s.shoot = false;
+    return events;
+}
+
+inline int sim_trap (SimState& s)
+{
+    const SimLayout& l = sim_layout;
+    if(s.trappy > l.trap_max || s.trappy < l.trap_min)
+        s.trappy_dir = -s.trappy_dir;
+    s.trappy += fx_mul(fx_time_step, s.trappy_dir);
+    SimBox trap = l.trap;
+    trap.y0 += s.trappy;
+    trap.y1 += s.trappy;
+    SimContact contact;
+    if(sim_box_contact(trap, sim_ball_x(s), sim_ball_y(s), fx_radius_object, contact))
+        return SIM_TRAPPED;
+    return 0;
+}
+
+/* One physics step, the same order of updates as the float path in draw() */
+inline int sim_tick (SimState& s)
+{
+    fixed_t x0 = sim_ball_x(s), y0 = sim_ball_y(s);
+    s.o += fx_time_step;
+    sim_move(s);
+    int events = sim_collect_coins(s, x0, y0);
+    events |= sim_collision(s);
+    events |= sim_trap(s);
+    s.tick++;
+    return events;
+}
+
+/* FNV-1a over the state */
+inline uint64_t sim_hash (const SimState& s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    fixed_t values[] = { s.shoot, s.o, s.ux, s.uy, s.vx, s.vy, s.newx, s.newy, s.collisionx, s.collisiony,
+                         s.ex, s.ey, s.trappy, s.trappy_dir, s.score, s.level, s.num_coin };
+    for(size_t v=0;v<sizeof(values)/sizeof(values[0]);v++)
+        fnv_mix(h, values[v]);
+    for(size_t r=0;r<s.coin_alive.size();r++)
+    {
+        h ^= s.coin_alive[r];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+/****************************************
+ * Compile-time geometry                *
+ ****************************************/
+/* Primitive meshes generated by constexpr functions, so the vertex tables are baked into
+   the binary: no trig at startup, no shared scratch array, and the vertex count of every
+   mesh is part of its type. Meshes are GL_TRIANGLES lists (GL_LINES for outlines) of
+   x,y,z positions in the z=0 plane, around the origin unless a centre is given */
+
+constexpr double GEO_PI = 3.14159265358979323846;
+
+/* Taylor series after reducing x to [-pi, pi], good to double precision */
+constexpr double geo_sin (double x)
+{
+    double turns = x / (2*GEO_PI);
+    long whole = (long)(turns < 0 ? turns - 0.5 : turns + 0.5);
+    x -= whole * 2*GEO_PI;
+    double term = x, sum = x;
+    for(int n=1; n<12; n++)
+    {
+        term *= -x*x / ((2*n)*(2*n+1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double geo_cos (double x) { return geo_sin(x + GEO_PI/2); }
+
+constexpr double geo_sqrt (double x)
+{
+    if(x <= 0)
+        return 0;
+    double r = x < 1 ? 1 : x;
+    for(int n=0; n<64; n++)
+        r = 0.5*(r + x/r);
+    return r;
+}
+
+/* asin through Newton on sin, x in [-1, 1] */
+constexpr double geo_asin (double x)
+{
+    double a = x;
+    for(int n=0; n<32; n++)
+    {
+        double c = geo_cos(a);
+        if(c == 0)
+            break;
+        a -= (geo_sin(a) - x) / c;
+    }
+    return a;
+}
+
+template <int N>
+struct Mesh {
+    static constexpr int num_vertices = N;
+    float positions[3*N];
+
+    constexpr void set (int v, double x, double y)
+    {
+        positions[3*v] = x;
+        positions[3*v+1] = y;
+        positions[3*v+2] = 0;
+    }
+};
+
+/* One color for every vertex of a mesh of N vertices */
+template <int N>
+struct MeshColors {
+    float rgb[3*N];
+};
+
+template <int N>
+constexpr MeshColors<N> solid_colors (double red, double green, double blue)
+{
+    MeshColors<N> c{};
+    for(int v=0; v<N; v++)
+    {
+        c.rgb[3*v] = red;
+        c.rgb[3*v+1] = green;
+        c.rgb[3*v+2] = blue;
+    }
+    return c;
+}
+
+/* Point of the circle of 'radius' around (cx,cy) at 'turn' (0..1 for a full circle) */
+constexpr double geo_circle_x (double cx, double radius, double turn) { return cx + radius*geo_cos(2*GEO_PI*turn); }
+constexpr double geo_circle_y (double cy, double radius, double turn) { return cy + radius*geo_sin(2*GEO_PI*turn); }
+
+/* Axis aligned rectangle as two triangles */
+constexpr Mesh<6> rect_mesh (double x0, double y0, double x1, double y1)
+{
+    Mesh<6> m{};
+    m.set(0, x0, y0); m.set(1, x1, y0); m.set(2, x1, y1);
+    m.set(3, x1, y1); m.set(4, x0, y1); m.set(5, x0, y0);
+    return m;
+}
+
+/* Disc as a fan of Segments triangles */
+template <int Segments>
+constexpr Mesh<3*Segments> circle_mesh (double radius=1, double cx=0, double cy=0)
+{
+    static_assert(Segments >= 3, "a circle needs at least 3 segments");
+    Mesh<3*Segments> m{};
+    for(int s=0; s<Segments; s++)
+    {
+        m.set(3*s, cx, cy);
+        m.set(3*s+1, geo_circle_x(cx, radius, (double)s/Segments), geo_circle_y(cy, radius, (double)s/Segments));
+        m.set(3*s+2, geo_circle_x(cx, radius, (double)(s+1)/Segments), geo_circle_y(cy, radius, (double)(s+1)/Segments));
+    }
+    return m;
+}
+
+/* Band between 'inner' and 'outer' from start_turn to end_turn (fractions of a full circle) */
+template <int Segments>
+constexpr Mesh<6*Segments> arc_mesh (double inner, double outer, double start_turn, double end_turn)
+{
+    static_assert(Segments >= 1, "an arc needs at least 1 segment");
+    Mesh<6*Segments> m{};
+    for(int s=0; s<Segments; s++)
+    {
+        double t0 = start_turn + (end_turn - start_turn)*s/Segments;
+        double t1 = start_turn + (end_turn - start_turn)*(s+1)/Segments;
+        double ix0 = geo_circle_x(0, inner, t0), iy0 = geo_circle_y(0, inner, t0);
+        double ox0 = geo_circle_x(0, outer, t0), oy0 = geo_circle_y(0, outer, t0);
+        double ix1 = geo_circle_x(0, inner, t1), iy1 = geo_circle_y(0, inner, t1);
+        double ox1 = geo_circle_x(0, outer, t1), oy1 = geo_circle_y(0, outer, t1);
+        m.set(6*s, ix0, iy0); m.set(6*s+1, ox0, oy0); m.set(6*s+2, ox1, oy1);
+        m.set(6*s+3, ox1, oy1); m.set(6*s+4, ix1, iy1); m.set(6*s+5, ix0, iy0);
+    }
+    return m;
+}
+
+/* Full band between 'inner' and 'outer' */
+template <int Segments>
+constexpr Mesh<6*Segments> ring_mesh (double inner, double outer=1)
+{
+    static_assert(Segments >= 3, "a ring needs at least 3 segments");
+    return arc_mesh<Segments>(inner, outer, 0, 1);
+}
+
+/* Rectangle from (0,0) to (width,height) with corners of 'radius', Segments per corner.
+   Three rectangles make the cross, a quarter fan fills each corner */
+template <int Segments>
+constexpr Mesh<18 + 12*Segments> rounded_rect_mesh (double width, double height, double radius)
+{
+    static_assert(Segments >= 1, "a corner needs at least 1 segment");
+    Mesh<18 + 12*Segments> m{};
+    const Mesh<6> parts[3] = { rect_mesh(0, radius, width, height-radius),
+                               rect_mesh(radius, 0, width-radius, radius),
+                               rect_mesh(radius, height-radius, width-radius, height) };
+    int v = 0;
+    for(int p=0; p<3; p++)
+        for(int k=0; k<6; k++, v++)
+            m.set(v, parts[p].positions[3*k], parts[p].positions[3*k+1]);
+
+    const double centres[4][2] = { {width-radius, height-radius}, {radius, height-radius},
+                                   {radius, radius}, {width-radius, radius} };
+    for(int c=0; c<4; c++)
+        for(int s=0; s<Segments; s++, v+=3)
+        {
+            double t0 = 0.25*c + 0.25*s/Segments, t1 = 0.25*c + 0.25*(s+1)/Segments;
+            m.set(v, centres[c][0], centres[c][1]);
+            m.set(v+1, geo_circle_x(centres[c][0], radius, t0), geo_circle_y(centres[c][1], radius, t0));
+            m.set(v+2, geo_circle_x(centres[c][0], radius, t1), geo_circle_y(centres[c][1], radius, t1));
+        }
+    return m;
+}
+
+/* Quad around a circle for distance-field rendering, 'extent' is its half size in radii */
+constexpr Mesh<6> circle_quad_mesh (double radius, double extent, double cx=0, double cy=0)
+{
+    return rect_mesh(cx - radius*extent, cy - radius*extent, cx + radius*extent, cy + radius*extent);
+}
+
+/* Per-vertex shape attribute matching circle_quad_mesh: position in radii, kind and spokes */
+struct CircleShape {
+    float values[4*6];
+};
+
+constexpr CircleShape circle_quad_shape (double extent, int kind, int spokes)
+{
+    CircleShape shape{};
+    Mesh<6> corners = rect_mesh(-extent, -extent, extent, extent);
+    for(int v=0; v<6; v++)
+    {
+        shape.values[4*v] = corners.positions[3*v];
+        shape.values[4*v+1] = corners.positions[3*v+1];
+        shape.values[4*v+2] = kind;
+        shape.values[4*v+3] = spokes;
+    }
+    return shape;
+}
+
+/* GL_LINES pair from the origin to the points where it touches the circle around (cx,cy) */
+constexpr Mesh<4> tangent_lines_mesh (double cx, double cy, double radius)
+{
+    Mesh<4> m{};
+    double dist = geo_sqrt(cx*cx + cy*cy);
+    double along = geo_sqrt(dist*dist - radius*radius);
+    double spread = geo_asin(radius/dist);
+    // unit axis towards the centre, rotated by +-spread
+    double ax = cx/dist, ay = cy/dist, c = geo_cos(spread), s = geo_sin(spread);
+    m.set(0, 0, 0);
+    m.set(1, along*(ax*c - ay*s), along*(ay*c + ax*s));
+    m.set(2, 0, 0);
+    m.set(3, along*(ax*c + ay*s), along*(ay*c - ax*s));
+    return m;
+}
+
+#endif
@@ -0,0 +1,412 @@
+#ifndef GL_TRACE_H
+#define GL_TRACE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <tuple>
+
+/****************************************
+ * GL call tracing                      *
+ ****************************************/
+/* Built with -DGL_TRACE every GL entry point the game calls goes through a wrapper that counts
+   it, the bytes it hands the driver and whether it changes state, per frame. --gl-check also
+   reads glGetError after every call and takes KHR_debug messages from a debug context.
+   Include it after the GL headers and before any GL call. Without GL_TRACE only empty hooks
+   are left and the GL names are untouched, release builds call the driver directly */
+
+#ifdef GL_TRACE
+
+enum GLTraceKind {
+    GL_TRACE_CALL,      // queries, object setup
+    GL_TRACE_STATE,     // binds and fixed function state
+    GL_TRACE_UPLOAD,    // buffer and uniform data
+    GL_TRACE_DRAW,
+};
+
+/* Argument 'N' of a call, for the byte counts */
+template <int N, typename... Args>
+inline long gl_trace_arg (Args... args) { return (long) std::get<N>(std::make_tuple(args...)); }
+
+/* X(name, kind, bytes uploaded), 'bytes' may use the call's arguments as args... */
+#define GL_TRACE_ENTRY_POINTS(X) \
+    X(glAttachShader, GL_TRACE_CALL, 0) \
+    X(glBeginQuery, GL_TRACE_CALL, 0) \
+    X(glBeginTransformFeedback, GL_TRACE_STATE, 0) \
+    X(glBindBuffer, GL_TRACE_STATE, 0) \
+    X(glBindBufferBase, GL_TRACE_STATE, 0) \
+    X(glBindFramebuffer, GL_TRACE_STATE, 0) \
+    X(glBindRenderbuffer, GL_TRACE_STATE, 0) \
+    X(glBindVertexArray, GL_TRACE_STATE, 0) \
+    X(glBlendFunc, GL_TRACE_STATE, 0) \
+    X(glBlitFramebuffer, GL_TRACE_DRAW, 0) \
+    X(glBufferData, GL_TRACE_UPLOAD, gl_trace_arg<1>(args...)) \
+    X(glBufferSubData, GL_TRACE_UPLOAD, gl_trace_arg<2>(args...)) \
+    X(glCheckFramebufferStatus, GL_TRACE_CALL, 0) \
+    X(glClear, GL_TRACE_DRAW, 0) \
+    X(glClearColor, GL_TRACE_STATE, 0) \
+    X(glClearDepth, GL_TRACE_STATE, 0) \
+    X(glClientWaitSync, GL_TRACE_CALL, 0) \
+    X(glColor3f, GL_TRACE_STATE, 0) \
+    X(glCompileShader, GL_TRACE_CALL, 0) \
+    X(glCreateProgram, GL_TRACE_CALL, 0) \
+    X(glCreateShader, GL_TRACE_CALL, 0) \
+    X(glDeleteBuffers, GL_TRACE_CALL, 0) \
+    X(glDeleteFramebuffers, GL_TRACE_CALL, 0) \
+    X(glDeleteProgram, GL_TRACE_CALL, 0) \
+    X(glDeleteQueries, GL_TRACE_CALL, 0) \
+    X(glDeleteRenderbuffers, GL_TRACE_CALL, 0) \
+    X(glDeleteShader, GL_TRACE_CALL, 0) \
+    X(glDeleteSync, GL_TRACE_CALL, 0) \
+    X(glDeleteVertexArrays, GL_TRACE_CALL, 0) \
+    X(glDepthFunc, GL_TRACE_STATE, 0) \
+    X(glDepthMask, GL_TRACE_STATE, 0) \
+    X(glDisable, GL_TRACE_STATE, 0) \
+    X(glDisableVertexAttribArray, GL_TRACE_STATE, 0) \
+    X(glDrawArrays, GL_TRACE_DRAW, 0) \
+    X(glEnable, GL_TRACE_STATE, 0) \
+    X(glEnableVertexAttribArray, GL_TRACE_STATE, 0) \
+    X(glEndQuery, GL_TRACE_CALL, 0) \
+    X(glEndTransformFeedback, GL_TRACE_STATE, 0) \
+    X(glFenceSync, GL_TRACE_CALL, 0) \
+    X(glFinish, GL_TRACE_CALL, 0) \
+    X(glFramebufferRenderbuffer, GL_TRACE_CALL, 0) \
+    X(glGenBuffers, GL_TRACE_CALL, 0) \
+    X(glGenFramebuffers, GL_TRACE_CALL, 0) \
+    X(glGenQueries, GL_TRACE_CALL, 0) \
+    X(glGenRenderbuffers, GL_TRACE_CALL, 0) \
+    X(glGenVertexArrays, GL_TRACE_CALL, 0) \
+    X(glGetProgramInfoLog, GL_TRACE_CALL, 0) \
+    X(glGetProgramiv, GL_TRACE_CALL, 0) \
+    X(glGetQueryObjectiv, GL_TRACE_CALL, 0) \
+    X(glGetQueryObjectui64v, GL_TRACE_CALL, 0) \
+    X(glGetShaderInfoLog, GL_TRACE_CALL, 0) \
+    X(glGetShaderiv, GL_TRACE_CALL, 0) \
+    X(glGetString, GL_TRACE_CALL, 0) \
+    X(glGetUniformLocation, GL_TRACE_CALL, 0) \
+    X(glLinkProgram, GL_TRACE_CALL, 0) \
+    X(glPolygonMode, GL_TRACE_STATE, 0) \
+    X(glRasterPos2f, GL_TRACE_STATE, 0) \
+    X(glRenderbufferStorage, GL_TRACE_CALL, 0) \
+    X(glShadeModel, GL_TRACE_STATE, 0) \
+    X(glShaderSource, GL_TRACE_CALL, 0) \
+    X(glTransformFeedbackVaryings, GL_TRACE_CALL, 0) \
+    X(glUniform1f, GL_TRACE_UPLOAD, 4) \
+    X(glUniform1i, GL_TRACE_UPLOAD, 4) \
+    X(glUniform1ui, GL_TRACE_UPLOAD, 4) \
+    X(glUniform2f, GL_TRACE_UPLOAD, 8) \
+    X(glUniform2iv, GL_TRACE_UPLOAD, gl_trace_arg<1>(args...)*8) \
+    X(glUniform4f, GL_TRACE_UPLOAD, 16) \
+    X(glUniform4fv, GL_TRACE_UPLOAD, gl_trace_arg<1>(args...)*16) \
+    X(glUniformMatrix4fv, GL_TRACE_UPLOAD, gl_trace_arg<1>(args...)*64) \
+    X(glUseProgram, GL_TRACE_STATE, 0) \
+    X(glVertexAttribPointer, GL_TRACE_STATE, 0) \
+    X(glViewport, GL_TRACE_STATE, 0)
+
+enum GLTraceCall {
+#define GL_TRACE_ENUM(name, kind, bytes) GL_CALL_##name,
+    GL_TRACE_ENTRY_POINTS(GL_TRACE_ENUM)
+#undef GL_TRACE_ENUM
+    NUM_GL_CALLS
+};
+
+const char* const gl_call_names[NUM_GL_CALLS] = {
+#define GL_TRACE_NAME(name, kind, bytes) #name,
+    GL_TRACE_ENTRY_POINTS(GL_TRACE_NAME)
+#undef GL_TRACE_NAME
+};
+
+const GLTraceKind gl_call_kinds[NUM_GL_CALLS] = {
+#define GL_TRACE_KIND(name, kind, bytes) kind,
+    GL_TRACE_ENTRY_POINTS(GL_TRACE_KIND)
+#undef GL_TRACE_KIND
+};
+
+#define GL_TRACE_REPORTED 16    // errors and debug messages printed before they are only counted
+
+struct GLTraceFrame {
+    long calls[NUM_GL_CALLS];
+    long total;
+    long state_changes;
+    long draws;
+    long upload_bytes;
+    long errors;
+    long debug_messages;
+};
+typedef struct GLTraceFrame GLTraceFrame;
+
+struct GLTrace {
+    bool check;             // --gl-check
+    bool debug_output;      // KHR_debug callback installed
+    GLTraceFrame frame;     // counting
+    GLTraceFrame last;      // the last finished frame
+    GLTraceFrame totals;
+    long frames;
+    long peak_calls;
+    long peak_bytes;
+    long reported;
+};
+typedef struct GLTrace GLTrace;
+
+static GLTrace gl_trace;
+
+/* Reads every pending error after 'call', the GL error queue can hold more than one */
+inline void gl_trace_check (GLTraceCall call)
+{
+    GLenum error;
+    while((error = glGetError()) != GL_NO_ERROR)
+    {
+        gl_trace.frame.errors++;
+        if(gl_trace.reported++ < GL_TRACE_REPORTED)
+            printf("GL error 0x%04x after %s\n", error, gl_call_names[call]);
+    }
+}
+
+inline void gl_trace_count (GLTraceCall call, GLTraceKind kind, long bytes)
+{
+    GLTraceFrame& f = gl_trace.frame;
+    f.calls[call]++;
+    f.total++;
+    f.state_changes += kind == GL_TRACE_STATE;
+    f.draws += kind == GL_TRACE_DRAW;
+    f.upload_bytes += bytes;
+}
+
+/* The wrappers are written out while the names still mean the driver's functions (or GLEW's
+   pointers), the names are pointed at the wrappers after. Each takes the exact parameters of
+   the function it wraps, so NULL and literals convert the way they did before */
+#define GL_TRACE_WRAP(name, kind, bytes) \
+    template <typename R, typename... P> \
+    constexpr auto gl_trace_wrap_##name (R (APIENTRY*)(P...)) \
+    { \
+        return [] (P... args) -> R { \
+            gl_trace_count(GL_CALL_##name, kind, bytes); \
+            /* reads the errors once the call has returned, whatever it returns */ \
+            struct Check { ~Check () { if(gl_trace.check) gl_trace_check(GL_CALL_##name); } } check; \
+            return name(args...); \
+        }; \
+    } \
+    constexpr auto gl_trace_##name = gl_trace_wrap_##name((decltype(+name)) NULL);
+GL_TRACE_ENTRY_POINTS(GL_TRACE_WRAP)
+#undef GL_TRACE_WRAP
+
+static void APIENTRY gl_trace_debug_message (GLenum /*source*/, GLenum /*type*/, GLuint /*id*/, GLenum severity,
+                                             GLsizei /*length*/, const GLchar* message, const void* /*user*/)
+{
+    gl_trace.frame.debug_messages++;
+    if(severity == GL_DEBUG_SEVERITY_NOTIFICATION)
+        return;
+    if(gl_trace.reported++ < GL_TRACE_REPORTED)
+        printf("GL debug: %s\n", message);
+}
+
+/* Asks for --gl-check, false when the build has no tracing */
+inline bool gl_trace_enable_check () { gl_trace.check = true; return true; }
+
+/* Whether the context should be made with GLUT_DEBUG */
+inline bool gl_trace_debug_context () { return gl_trace.check; }
+
+/* Installs the KHR_debug callback once the context and GLEW are up */
+inline void gl_trace_init ()
+{
+    if(!gl_trace.check || !GLEW_KHR_debug)
+        return;
+    glEnable(GL_DEBUG_OUTPUT);
+    // messages arrive on the thread and inside the call that caused them
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    glDebugMessageCallback(gl_trace_debug_message, NULL);
+    gl_trace.debug_output = true;
+}
+
+/* Closes the frame's counters, call after the swap */
+inline void gl_trace_frame ()
+{
+    GLTraceFrame& f = gl_trace.frame;
+    GLTraceFrame& t = gl_trace.totals;
+    for(int c=0;c<NUM_GL_CALLS;c++)
+        t.calls[c] += f.calls[c];
+    t.total += f.total;
+    t.state_changes += f.state_changes;
+    t.draws += f.draws;
+    t.upload_bytes += f.upload_bytes;
+    t.errors += f.errors;
+    t.debug_messages += f.debug_messages;
+    gl_trace.peak_calls = std::max(gl_trace.peak_calls, f.total);
+    gl_trace.peak_bytes = std::max(gl_trace.peak_bytes, f.upload_bytes);
+    gl_trace.frames++;
+    gl_trace.last = f;
+    memset(&f, 0, sizeof(f));
+}
+
+inline void gl_trace_print ()
+{
+    const GLTraceFrame& l = gl_trace.last;
+    const GLTraceFrame& t = gl_trace.totals;
+    double frames = std::max(gl_trace.frames, 1L);
+    printf("GL calls: %ld last frame (%ld state changes, %ld draws, %ld bytes uploaded), peak %ld calls %ld bytes\n",
+           l.total, l.state_changes, l.draws, l.upload_bytes, gl_trace.peak_calls, gl_trace.peak_bytes);
+    printf("  %-28s %10s %12s\n", "entry point", "last frame", "per frame");
+    for(int c=0;c<NUM_GL_CALLS;c++)
+        if(t.calls[c])
+            printf("  %-28s %10ld %12.2f\n", gl_call_names[c], l.calls[c], t.calls[c]/frames);
+    if(gl_trace.check)
+        printf("GL errors: %ld, debug messages: %ld%s\n", t.errors, t.debug_messages,
+               gl_trace.debug_output ? "" : " (no KHR_debug)");
+}
+
+#undef glAttachShader
+#define glAttachShader gl_trace_glAttachShader
+#undef glBeginQuery
+#define glBeginQuery gl_trace_glBeginQuery
+#undef glBeginTransformFeedback
+#define glBeginTransformFeedback gl_trace_glBeginTransformFeedback
+#undef glBindBuffer
+#define glBindBuffer gl_trace_glBindBuffer
+#undef glBindBufferBase
+#define glBindBufferBase gl_trace_glBindBufferBase
+#undef glBindFramebuffer
+#define glBindFramebuffer gl_trace_glBindFramebuffer
+#undef glBindRenderbuffer
+#define glBindRenderbuffer gl_trace_glBindRenderbuffer
+#undef glBindVertexArray
+#define glBindVertexArray gl_trace_glBindVertexArray
+#undef glBlendFunc
+#define glBlendFunc gl_trace_glBlendFunc
+#undef glBlitFramebuffer
+#define glBlitFramebuffer gl_trace_glBlitFramebuffer
+#undef glBufferData
+#define glBufferData gl_trace_glBufferData
+#undef glBufferSubData
+#define glBufferSubData gl_trace_glBufferSubData
+#undef glCheckFramebufferStatus
+#define glCheckFramebufferStatus gl_trace_glCheckFramebufferStatus
+#undef glClear
+#define glClear gl_trace_glClear
+#undef glClearColor
+#define glClearColor gl_trace_glClearColor
+#undef glClearDepth
+#define glClearDepth gl_trace_glClearDepth
+#undef glClientWaitSync
+#define glClientWaitSync gl_trace_glClientWaitSync
+#undef glColor3f
+#define glColor3f gl_trace_glColor3f
+#undef glCompileShader
+#define glCompileShader gl_trace_glCompileShader
+#undef glCreateProgram
+#define glCreateProgram gl_trace_glCreateProgram
+#undef glCreateShader
+#define glCreateShader gl_trace_glCreateShader
+#undef glDeleteBuffers
+#define glDeleteBuffers gl_trace_glDeleteBuffers
+#undef glDeleteFramebuffers
+#define glDeleteFramebuffers gl_trace_glDeleteFramebuffers
+#undef glDeleteProgram
+#define glDeleteProgram gl_trace_glDeleteProgram
+#undef glDeleteQueries
+#define glDeleteQueries gl_trace_glDeleteQueries
+#undef glDeleteRenderbuffers
+#define glDeleteRenderbuffers gl_trace_glDeleteRenderbuffers
+#undef glDeleteShader
+#define glDeleteShader gl_trace_glDeleteShader
+#undef glDeleteSync
+#define glDeleteSync gl_trace_glDeleteSync
+#undef glDeleteVertexArrays
+#define glDeleteVertexArrays gl_trace_glDeleteVertexArrays
+#undef glDepthFunc
+#define glDepthFunc gl_trace_glDepthFunc
+#undef glDepthMask
+#define glDepthMask gl_trace_glDepthMask
+#undef glDisable
+#define glDisable gl_trace_glDisable
+#undef glDisableVertexAttribArray
+#define glDisableVertexAttribArray gl_trace_glDisableVertexAttribArray
+#undef glDrawArrays
+#define glDrawArrays gl_trace_glDrawArrays
+#undef glEnable
+#define glEnable gl_trace_glEnable
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray gl_trace_glEnableVertexAttribArray
+#undef glEndQuery
+#define glEndQuery gl_trace_glEndQuery
+#undef glEndTransformFeedback
+#define glEndTransformFeedback gl_trace_glEndTransformFeedback
+#undef glFenceSync
+#define glFenceSync gl_trace_glFenceSync
+#undef glFinish
+#define glFinish gl_trace_glFinish
+#undef glFramebufferRenderbuffer
+#define glFramebufferRenderbuffer gl_trace_glFramebufferRenderbuffer
+#undef glGenBuffers
+#define glGenBuffers gl_trace_glGenBuffers
+#undef glGenFramebuffers
+#define glGenFramebuffers gl_trace_glGenFramebuffers
+#undef glGenQueries
+#define glGenQueries gl_trace_glGenQueries
+#undef glGenRenderbuffers
+#define glGenRenderbuffers gl_trace_glGenRenderbuffers
+#undef glGenVertexArrays
+#define glGenVertexArrays gl_trace_glGenVertexArrays
+#undef glGetProgramInfoLog
+#define glGetProgramInfoLog gl_trace_glGetProgramInfoLog
+#undef glGetProgramiv
+#define glGetProgramiv gl_trace_glGetProgramiv
+#undef glGetQueryObjectiv
+#define glGetQueryObjectiv gl_trace_glGetQueryObjectiv
+#undef glGetQueryObjectui64v
+#define glGetQueryObjectui64v gl_trace_glGetQueryObjectui64v
+#undef glGetShaderInfoLog
+#define glGetShaderInfoLog gl_trace_glGetShaderInfoLog
+#undef glGetShaderiv
+#define glGetShaderiv gl_trace_glGetShaderiv
+#undef glGetString
+#define glGetString gl_trace_glGetString
+#undef glGetUniformLocation
+#define glGetUniformLocation gl_trace_glGetUniformLocation
+#undef glLinkProgram
+#define glLinkProgram gl_trace_glLinkProgram
+#undef glPolygonMode
+#define glPolygonMode gl_trace_glPolygonMode
+#undef glRasterPos2f
+#define glRasterPos2f gl_trace_glRasterPos2f
+#undef glRenderbufferStorage
+#define glRenderbufferStorage gl_trace_glRenderbufferStorage
+#undef glShadeModel
+#define glShadeModel gl_trace_glShadeModel
+#undef glShaderSource
+#define glShaderSource gl_trace_glShaderSource
+#undef glTransformFeedbackVaryings
+#define glTransformFeedbackVaryings gl_trace_glTransformFeedbackVaryings
+#undef glUniform1f
+#define glUniform1f gl_trace_glUniform1f
+#undef glUniform1i
+#define glUniform1i gl_trace_glUniform1i
+#undef glUniform1ui
+#define glUniform1ui gl_trace_glUniform1ui
+#undef glUniform2f
+#define glUniform2f gl_trace_glUniform2f
+#undef glUniform2iv
+#define glUniform2iv gl_trace_glUniform2iv
+#undef glUniform4f
+#define glUniform4f gl_trace_glUniform4f
+#undef glUniform4fv
+#define glUniform4fv gl_trace_glUniform4fv
+#undef glUniformMatrix4fv
+#define glUniformMatrix4fv gl_trace_glUniformMatrix4fv
+#undef glUseProgram
+#define glUseProgram gl_trace_glUseProgram
+#undef glVertexAttribPointer
+#define glVertexAttribPointer gl_trace_glVertexAttribPointer
+#undef glViewport
+#define glViewport gl_trace_glViewport
+
+#else
+
+inline bool gl_trace_enable_check () { return false; }
+inline bool gl_trace_debug_context () { return false; }
+inline void gl_trace_init () {}
+inline void gl_trace_frame () {}
+inline void gl_trace_print () {}
+
+#endif
+
+#endif
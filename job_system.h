@@ -0,0 +1,245 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/****************************************
+ * Work-stealing jobs                   *
+ ****************************************/
+/* A JobGraph holds jobs and the order between them, JobSystem runs a graph to completion.
+   Every thread, the caller included, owns a queue of ready jobs. It takes its own newest job
+   first so a chain of jobs stays on one core, and when it runs dry it steals the oldest job
+   from another queue. A job becomes ready when the last job it waits for finishes and goes
+   on the queue of the thread that finished it. A graph can be run again every frame */
+
+typedef int JobId;
+
+class JobGraph {
+public:
+    void clear () { jobs_.clear(); }
+    int size () const { return jobs_.size(); }
+
+    /* Adds a job that runs 'fn', an empty one only joins the jobs it waits for */
+    JobId add (const std::function<void()>& fn)
+    {
+        Job job;
+        job.fn = fn;
+        job.dependencies = 0;
+        jobs_.push_back(job);
+        return jobs_.size() - 1;
+    }
+
+    /* 'job' runs after 'before' has finished */
+    void depend (JobId job, JobId before)
+    {
+        jobs_[before].successors.push_back(job);
+        jobs_[job].dependencies++;
+    }
+
+    /* Splits [begin,end) into jobs of 'grain' items that call fn(first, last), all of them
+       after 'after' unless it is -1. Returns a job that finishes once every part has */
+    JobId parallel_for (int begin, int end, int grain, const std::function<void(int, int)>& fn, JobId after=-1)
+    {
+        JobId join = add(std::function<void()>());
+        if(begin >= end && after >= 0)
+            depend(join, after);
+        for(int first=begin; first<end; first+=grain)
+        {
+            int last = std::min(end, first + grain);
+            JobId part = add([fn, first, last] { fn(first, last); });
+            if(after >= 0)
+                depend(part, after);
+            depend(join, part);
+        }
+        return join;
+    }
+
+private:
+    friend class JobSystem;
+
+    struct Job {
+        std::function<void()> fn;
+        std::vector<JobId> successors;
+        int dependencies;
+    };
+
+    std::vector<Job> jobs_;
+};
+
+class JobSystem {
+public:
+    explicit JobSystem (int threads) : queues_(std::max(threads, 1)), graph_(NULL), remaining_(0), busy_(0),
+                                       generation_(0), stop_(false), executed_(0), stolen_(0)
+    {
+        for(int t=1;t<threads;t++)
+            workers_.push_back(std::thread(&JobSystem::worker, this, t));
+    }
+
+    ~JobSystem ()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for(size_t t=0;t<workers_.size();t++)
+            workers_[t].join();
+    }
+
+    JobSystem (const JobSystem&) = delete;
+    JobSystem& operator= (const JobSystem&) = delete;
+
+    int size () const { return queues_.size(); }
+    long executed () const { return executed_; }
+    long stolen () const { return stolen_; }
+
+    /* Runs every job of 'graph' on the calling thread and the workers, returns when all are done */
+    void run (JobGraph& graph)
+    {
+        int n = graph.size();
+        if(n == 0)
+            return;
+        if(pending_.size() < (size_t)n)
+            pending_ = std::vector<std::atomic<int> >(n);
+        for(int j=0;j<n;j++)
+            pending_[j].store(graph.jobs_[j].dependencies, std::memory_order_relaxed);
+        graph_ = &graph;
+        remaining_.store(n, std::memory_order_relaxed);
+
+        // the first jobs are dealt out over the queues so every thread starts with work
+        int queue = 0, runnable = 0;
+        for(int j=0;j<n;j++)
+        {
+            if(graph.jobs_[j].dependencies == 0)
+                push(queue++ % size(), j);
+            if(graph.jobs_[j].fn)
+                runnable++;
+        }
+
+        // a lone job, joins aside, is not worth waking anybody for
+        if(workers_.empty() || runnable <= 1)
+        {
+            work(0);
+            graph_ = NULL;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busy_ = workers_.size();
+            generation_++;
+        }
+        wake_.notify_all();
+        work(0);
+
+        // the workers still look at the graph until they see it is finished
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [this] { return busy_ == 0; });
+        graph_ = NULL;
+    }
+
+private:
+    struct alignas(64) WorkQueue {
+        std::mutex mutex;
+        std::deque<JobId> jobs;
+    };
+
+    void push (int queue, JobId job)
+    {
+        std::lock_guard<std::mutex> lock(queues_[queue].mutex);
+        queues_[queue].jobs.push_back(job);
+    }
+
+    bool pop (int queue, JobId& job)
+    {
+        std::lock_guard<std::mutex> lock(queues_[queue].mutex);
+        if(queues_[queue].jobs.empty())
+            return false;
+        job = queues_[queue].jobs.back();
+        queues_[queue].jobs.pop_back();
+        return true;
+    }
+
+    bool steal (int self, JobId& job)
+    {
+        for(int i=1;i<size();i++)
+        {
+            WorkQueue& victim = queues_[(self + i) % size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(victim.jobs.empty())
+                continue;
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            stolen_++;
+            return true;
+        }
+        return false;
+    }
+
+    void execute (int self, JobId job)
+    {
+        JobGraph::Job& j = graph_->jobs_[job];
+        if(j.fn)
+            j.fn();
+        for(size_t s=0;s<j.successors.size();s++)
+            if(pending_[j.successors[s]].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                push(self, j.successors[s]);
+        executed_++;
+        remaining_.fetch_sub(1, std::memory_order_release);
+    }
+
+    /* Runs and steals jobs until the whole graph is done */
+    void work (int self)
+    {
+        while(remaining_.load(std::memory_order_acquire) > 0)
+        {
+            JobId job;
+            if(pop(self, job) || steal(self, job))
+                execute(self, job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    void worker (int self)
+    {
+        uint64_t seen = 0;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+                if(stop_)
+                    return;
+                seen = generation_;
+            }
+            work(self);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                busy_--;
+            }
+            finished_.notify_one();
+        }
+    }
+
+    std::vector<WorkQueue> queues_;
+    std::vector<std::thread> workers_;
+    std::vector<std::atomic<int> > pending_;    // unfinished dependencies of every job
+    JobGraph* graph_;
+    std::atomic<int> remaining_;                // jobs of the graph not finished yet
+    int busy_;                                  // workers still inside the current run
+    uint64_t generation_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable wake_, finished_;
+    std::atomic<long> executed_, stolen_;
+};
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef REWIND_BUFFER_H
+#define REWIND_BUFFER_H
+
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+/****************************************
+ * Rewind buffer                        *
+ ****************************************/
+/* Keeps the last few seconds of game state in a fixed memory budget. Frames are
+   grouped behind a keyframe. Every other frame only stores the scalars that changed
+   and the list of coins whose flag flipped, coin flags are kept as a bitset.
+   When the budget or the time window is exceeded the oldest group is dropped. The budget
+   caps the storage held, spare storage kept for reuse included, and a frame that does not
+   fit it on its own is refused */
+
+#define REWIND_SCALARS 20
+
+struct RewindFrame {
+    double scalars[REWIND_SCALARS];     // ball, trap, score, level and launch point, compared bit for bit
+    std::vector<uint64_t> coins;        // one bit per coin flag
+};
+typedef struct RewindFrame RewindFrame;
+
+class RewindBuffer {
+public:
+    RewindBuffer (size_t budget_bytes, int max_frames, int keyframe_interval) :
+        budget_(budget_bytes), max_frames_(max_frames), keyframe_interval_(keyframe_interval), bytes_(0), spare_bytes_(0),
+        frames_(0), refused_(0), next_tick_(0) {}
+
+    /* Appends the frame of 'tick', ticks must increase by one between calls. Returns false when
+       it was refused for being larger than the budget, the buffer is emptied then */
+    bool record (uint64_t tick, const RewindFrame& frame)
+    {
+        if(keyframe_bytes(frame) > budget_)
+        {
+            last_ = frame;
+            clear();
+            free_spare();
+            refused_++;
+            next_tick_ = tick+1;
+            return false;
+        }
+        if(groups_.empty() || groups_.back().offsets.size() >= (size_t)keyframe_interval_ || tick != next_tick_)
+            start_group(tick, frame);
+        else
+            append_delta(frame);
+        last_ = frame;
+        next_tick_ = tick+1;
+        frames_++;
+        trim();
+        return !groups_.empty();
+    }
+
+    /* Rebuilds the frame of 'tick', false when it is no longer (or not yet) in the buffer */
+    bool restore (uint64_t tick, RewindFrame& frame) const
+    {
+        for(size_t g=0;g<groups_.size();g++)
+        {
+            const Group& group = groups_[g];
+            if(tick < group.first_tick || tick >= group.first_tick + group.offsets.size())
+                continue;
+            size_t pos = 0;
+            decode_keyframe(group.data, pos, frame);
+            for(uint64_t t=group.first_tick; t<tick; t++)
+                decode_delta(group.data, pos, frame);
+            return true;
+        }
+        return false;
+    }
+
+    /* Forgets every frame after 'tick', recording carries on from the frame of 'tick' */
+    void truncate_after (uint64_t tick, const RewindFrame& frame)
+    {
+        while(!groups_.empty() && groups_.back().first_tick > tick)
+            drop_back();
+        if(groups_.empty())
+            return;
+        Group& group = groups_.back();
+        size_t keep = tick - group.first_tick + 1;
+        if(keep < group.offsets.size())
+        {
+            // the storage stays with the group, only the frames go
+            frames_ -= group.offsets.size() - keep;
+            group.data.resize(group.offsets[keep]);
+            group.offsets.resize(keep);
+        }
+        last_ = frame;
+        next_tick_ = tick+1;
+    }
+
+    void clear ()
+    {
+        while(!groups_.empty())
+            drop_back();
+    }
+
+    bool empty () const { return groups_.empty(); }
+    uint64_t oldest_tick () const { return groups_.empty() ? 0 : groups_.front().first_tick; }
+    uint64_t newest_tick () const { return next_tick_ - 1; }
+    size_t bytes () const { return bytes_ + spare_bytes_; }    // storage held
+    size_t budget () const { return budget_; }
+    size_t frames () const { return frames_; }
+    size_t keyframes () const { return groups_.size(); }
+    size_t refused () const { return refused_; }
+
+    /* Size of 'frame' as a keyframe, the largest a single frame gets */
+    static size_t keyframe_bytes (const RewindFrame& frame)
+    {
+        return sizeof(frame.scalars) + sizeof(uint32_t) + frame.coins.size()*sizeof(uint64_t) + sizeof(uint32_t);
+    }
+
+private:
+    struct Group {
+        uint64_t first_tick;
+        std::vector<uint32_t> offsets;  // start of every frame in data
+        std::vector<uint8_t> data;
+    };
+
+    void start_group (uint64_t tick, const RewindFrame& frame)
+    {
+        groups_.push_back(Group());
+        Group& group = groups_.back();
+        if(spare_.capacity())
+        {
+            // reuse the storage of a dropped group
+            group.data.swap(spare_);
+            spare_bytes_ = 0;
+            bytes_ += group.data.capacity();
+        }
+        size_t held = held_bytes(group);
+        group.first_tick = tick;
+        group.offsets.push_back(0);
+        put(group.data, frame.scalars, sizeof(frame.scalars));
+        uint32_t words = frame.coins.size();
+        put(group.data, &words, sizeof(words));
+        if(words)
+            put(group.data, &frame.coins[0], words*sizeof(uint64_t));
+        bytes_ += held_bytes(group) - held;
+    }
+
+    void append_delta (const RewindFrame& frame)
+    {
+        Group& group = groups_.back();
+        size_t held = held_bytes(group);
+        group.offsets.push_back(group.data.size());
+
+        uint32_t changed = 0;
+        for(int v=0;v<REWIND_SCALARS;v++)
+            if(memcmp(&frame.scalars[v], &last_.scalars[v], sizeof(double)) != 0)
+                changed |= 1u << v;
+        put(group.data, &changed, sizeof(changed));
+        for(int v=0;v<REWIND_SCALARS;v++)
+            if(changed & (1u << v))
+                put(group.data, &frame.scalars[v], sizeof(double));
+
+        // coin flags rarely change, store the indices that flipped
+        std::vector<uint32_t>& flips = flips_;
+        flips.clear();
+        size_t words = std::max(frame.coins.size(), last_.coins.size());
+        for(size_t w=0;w<words;w++)
+        {
+            uint64_t diff = word(frame.coins, w) ^ word(last_.coins, w);
+            for(int b=0; diff; b++, diff >>= 1)
+                if(diff & 1)
+                    flips.push_back(w*64 + b);
+        }
+        uint32_t count = flips.size();
+        put(group.data, &count, sizeof(count));
+        if(count)
+            put(group.data, &flips[0], count*sizeof(uint32_t));
+        uint32_t coin_words = frame.coins.size();
+        put(group.data, &coin_words, sizeof(coin_words));
+
+        bytes_ += held_bytes(group) - held;
+    }
+
+    static void decode_keyframe (const std::vector<uint8_t>& data, size_t& pos, RewindFrame& frame)
+    {
+        get(data, pos, frame.scalars, sizeof(frame.scalars));
+        uint32_t words;
+        get(data, pos, &words, sizeof(words));
+        frame.coins.resize(words);
+        if(words)
+            get(data, pos, &frame.coins[0], words*sizeof(uint64_t));
+    }
+
+    static void decode_delta (const std::vector<uint8_t>& data, size_t& pos, RewindFrame& frame)
+    {
+        uint32_t changed;
+        get(data, pos, &changed, sizeof(changed));
+        for(int v=0;v<REWIND_SCALARS;v++)
+            if(changed & (1u << v))
+                get(data, pos, &frame.scalars[v], sizeof(double));
+        uint32_t count;
+        get(data, pos, &count, sizeof(count));
+        for(uint32_t f=0;f<count;f++)
+        {
+            uint32_t coin;
+            get(data, pos, &coin, sizeof(coin));
+            if(coin/64 >= frame.coins.size())
+                frame.coins.resize(coin/64 + 1, 0);
+            frame.coins[coin/64] ^= (uint64_t)1 << (coin%64);
+        }
+        uint32_t coin_words;
+        get(data, pos, &coin_words, sizeof(coin_words));
+        frame.coins.resize(coin_words, 0);
+    }
+
+    static size_t held_bytes (const Group& group)
+    {
+        return group.data.capacity() + group.offsets.capacity()*sizeof(uint32_t);
+    }
+
+    /* Drops whole groups from the front until both limits hold. Over the budget the spare
+       storage goes first, and the newest group too when its deltas alone outgrew the budget */
+    void trim ()
+    {
+        if(bytes() > budget_)
+            free_spare();
+        while(!groups_.empty() && (bytes() > budget_ ||
+              (groups_.size() > 1 && frames_ - groups_.front().offsets.size() >= (size_t)max_frames_)))
+        {
+            drop(groups_.front());
+            groups_.pop_front();
+            if(bytes() > budget_)
+                free_spare();
+        }
+    }
+
+    void drop_back ()
+    {
+        drop(groups_.back());
+        groups_.pop_back();
+    }
+
+    /* Forgets the frames of 'group', its data storage is kept for the next group if there is room */
+    void drop (Group& group)
+    {
+        bytes_ -= held_bytes(group);
+        frames_ -= group.offsets.size();
+        group.data.clear();
+        if(spare_.capacity() < group.data.capacity())
+        {
+            spare_.swap(group.data);
+            spare_bytes_ = spare_.capacity();
+        }
+    }
+
+    void free_spare ()
+    {
+        std::vector<uint8_t>().swap(spare_);
+        spare_bytes_ = 0;
+    }
+
+    static uint64_t word (const std::vector<uint64_t>& bits, size_t w) { return w < bits.size() ? bits[w] : 0; }
+
+    static void put (std::vector<uint8_t>& data, const void* src, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*) src;
+        data.insert(data.end(), bytes, bytes + size);
+    }
+
+    static void get (const std::vector<uint8_t>& data, size_t& pos, void* dst, size_t size)
+    {
+        memcpy(dst, &data[pos], size);
+        pos += size;
+    }
+
+    size_t budget_;
+    int max_frames_;
+    int keyframe_interval_;
+    size_t bytes_;          // held by the groups
+    size_t spare_bytes_;
+    size_t frames_;
+    size_t refused_;
+    uint64_t next_tick_;
+    std::deque<Group> groups_;
+    std::vector<uint8_t> spare_;    // storage of a dropped group, empty or with capacity
+    std::vector<uint32_t> flips_;
+    RewindFrame last_;
+};
+
+#endif
@@ -0,0 +1,249 @@
+#ifndef SHOT_INDEX_H
+#define SHOT_INDEX_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "game_sim.h"
+#include "game_env.h"
+
+/****************************************
+ * Reachability index                   *
+ ****************************************/
+/* Maps every coin cell of the level to the (canon_rotation, power_meter) pairs whose
+   arcs pass close enough to collect a coin there. It is built offline by simulating
+   each shot with the fixed-point physics, stored in a compact binary file keyed by
+   sim_layout_hash() and memory mapped by the game, so a hint is a lookup.
+   The trap is left out, whether it is in the way depends on when the shot is fired.
+
+   File layout: ShotIndexHeader, num_shots ShotIndexEntry, num_cells+1 uint32 offsets
+   into the postings, num_postings uint16 shot numbers sorted per cell */
+
+#define SHOT_INDEX_MAGIC "DNAHBIDX"
+#define SHOT_INDEX_VERSION 3
+#define SHOT_INDEX_MAX_TICKS 3000
+
+struct ShotIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_shots;
+    uint64_t layout_hash;
+    uint32_t num_cells;
+    uint32_t num_postings;
+};
+typedef struct ShotIndexHeader ShotIndexHeader;
+
+struct ShotIndexEntry {
+    float rotation;     // canon_rotation in degrees
+    float power;        // power_meter
+};
+typedef struct ShotIndexEntry ShotIndexEntry;
+
+struct ShotIndex {
+    void* map;
+    size_t size;
+    const ShotIndexHeader* header;
+    const ShotIndexEntry* shots;
+    const uint32_t* offsets;
+    const uint16_t* postings;
+};
+typedef struct ShotIndex ShotIndex;
+
+inline int shot_index_num_cells () { return sim_layout.coin_grid_w * sim_layout.coin_grid_h; }
+
+/* Cell of a coin at world position (x,y), -1 when off the coin grid */
+inline int shot_index_cell (double x, double y)
+{
+    int cx = (int)floor(x*10 + 0.5) - sim_layout.coin_grid_x0;
+    int cy = (int)floor(y*10 + 0.5) - sim_layout.coin_grid_y0;
+    if(cx < 0 || cx >= sim_layout.coin_grid_w || cy < 0 || cy >= sim_layout.coin_grid_h)
+        return -1;
+    return cy*sim_layout.coin_grid_w + cx;
+}
+
+/* Marks every cell whose coin the ball moving from (x0,y0) to (x1,y1) would collect, same test as sim_collect_coins */
+inline void shot_index_mark (fixed_t x0, fixed_t y0, fixed_t x1, fixed_t y1, std::vector<unsigned char>& cells)
+{
+    const SimLayout& l = sim_layout;
+    fixed_t reach = fx_radius_coins + fx_radius_object;
+    int cx0 = std::max(0, (int)((std::min(x0, x1) - reach)*10 / FX_ONE) - 1 - l.coin_grid_x0);
+    int cx1 = std::min(l.coin_grid_w-1, (int)((std::max(x0, x1) + reach)*10 / FX_ONE) + 1 - l.coin_grid_x0);
+    int cy0 = std::max(0, (int)((std::min(y0, y1) - reach)*10 / FX_ONE) - 1 - l.coin_grid_y0);
+    int cy1 = std::min(l.coin_grid_h-1, (int)((std::max(y0, y1) + reach)*10 / FX_ONE) + 1 - l.coin_grid_y0);
+    for(int cy=cy0;cy<=cy1;cy++)
+        for(int cx=cx0;cx<=cx1;cx++)
+        {
+            fixed_t t;
+            if(sim_sweep_point(x0, y0, x1 - x0, y1 - y0, (fixed_t)(cx + l.coin_grid_x0) * FX_ONE / 10,
+                               (fixed_t)(cy + l.coin_grid_y0) * FX_ONE / 10, reach, t))
+                cells[cy*l.coin_grid_w + cx] = 1;
+        }
+}
+
+/* Flies one shot until the ball rests and returns the cells it sweeps, in increasing order */
+inline void shot_index_trace (const ShotIndexEntry& shot, std::vector<uint16_t>& swept)
+{
+    SimState s;
+    sim_reset(s, 0);
+    sim_shoot(s, FX(shot.rotation), FX(shot.power));
+    std::vector<unsigned char> cells(shot_index_num_cells(), 0);
+    for(int t=0; t<SHOT_INDEX_MAX_TICKS && s.shoot; t++)
+    {
+        // the order of sim_tick, coins are tested right after the move
+        fixed_t x0 = sim_ball_x(s), y0 = sim_ball_y(s);
+        s.o += fx_time_step;
+        sim_move(s);
+        shot_index_mark(x0, y0, sim_ball_x(s), sim_ball_y(s), cells);
+        sim_collision(s);
+    }
+    swept.clear();
+    for(size_t c=0;c<cells.size();c++)
+        if(cells[c])
+            swept.push_back(c);
+}
+
+/* Simulates every canon rotation the keys can reach (2..176 in steps of 3) with powers
+   0.5..16 and writes the index to 'path' */
+inline bool shot_index_build (const char* path, int threads)
+{
+    std::vector<ShotIndexEntry> shots;
+    for(int rotation=2; rotation<177; rotation+=3)
+        for(int power=1; power<=32; power++)
+        {
+            ShotIndexEntry shot = { (float)rotation, power*0.5f };
+            shots.push_back(shot);
+        }
+
+    std::vector< std::vector<uint16_t> > swept(shots.size());
+    ThreadPool pool(threads);
+    pool.run(shots.size(), [&](int s) { shot_index_trace(shots[s], swept[s]); });
+
+    // invert shot -> cells into cell -> shots, shots come out sorted per cell
+    int num_cells = shot_index_num_cells();
+    std::vector<uint32_t> offsets(num_cells+1, 0);
+    for(size_t s=0;s<shots.size();s++)
+        for(size_t c=0;c<swept[s].size();c++)
+            offsets[swept[s][c]+1]++;
+    for(int c=0;c<num_cells;c++)
+        offsets[c+1] += offsets[c];
+    std::vector<uint16_t> postings(offsets[num_cells]);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end()-1);
+    for(size_t s=0;s<shots.size();s++)
+        for(size_t c=0;c<swept[s].size();c++)
+            postings[fill[swept[s][c]]++] = s;
+
+    ShotIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SHOT_INDEX_MAGIC, 8);
+    header.version = SHOT_INDEX_VERSION;
+    header.num_shots = shots.size();
+    header.layout_hash = sim_layout_hash();
+    header.num_cells = num_cells;
+    header.num_postings = postings.size();
+
+    FILE* out = fopen(path, "wb");
+    if(out == NULL)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              fwrite(&shots[0], sizeof(ShotIndexEntry), shots.size(), out) == shots.size() &&
+              fwrite(&offsets[0], sizeof(uint32_t), offsets.size(), out) == offsets.size() &&
+              (postings.empty() || fwrite(&postings[0], sizeof(uint16_t), postings.size(), out) == postings.size());
+    return fclose(out) == 0 && ok;
+}
+
+inline void shot_index_close (ShotIndex& index)
+{
+    if(index.map)
+        munmap(index.map, index.size);
+    memset(&index, 0, sizeof(index));
+}
+
+/* Whether every cell's postings lie within the file and name a shot in it, so queries never
+   read outside the mapping however the file was damaged */
+inline bool shot_index_valid (const ShotIndex& index)
+{
+    const ShotIndexHeader& header = *index.header;
+    if(index.offsets[0] != 0 || index.offsets[header.num_cells] != header.num_postings)
+        return false;
+    for(uint32_t c=0;c<header.num_cells;c++)
+        if(index.offsets[c] > index.offsets[c+1])
+            return false;
+    for(uint32_t p=0;p<header.num_postings;p++)
+        if(index.postings[p] >= header.num_shots)
+            return false;
+    return true;
+}
+
+/* Maps the index read-only, fails on a bad or damaged file or one built for another layout */
+inline bool shot_index_open (ShotIndex& index, const char* path)
+{
+    memset(&index, 0, sizeof(index));
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShotIndexHeader)) {
+        close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return false;
+
+    const ShotIndexHeader* header = (const ShotIndexHeader*) map;
+    size_t expected = sizeof(ShotIndexHeader) + header->num_shots*sizeof(ShotIndexEntry) +
+                      (header->num_cells+1)*sizeof(uint32_t) + header->num_postings*sizeof(uint16_t);
+    if(memcmp(header->magic, SHOT_INDEX_MAGIC, 8) != 0 || header->version != SHOT_INDEX_VERSION ||
+       header->layout_hash != sim_layout_hash() || (int)header->num_cells != shot_index_num_cells() ||
+       expected != (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    index.map = map;
+    index.size = st.st_size;
+    index.header = header;
+    index.shots = (const ShotIndexEntry*) (header + 1);
+    index.offsets = (const uint32_t*) (index.shots + header->num_shots);
+    index.postings = (const uint16_t*) (index.offsets + header->num_cells + 1);
+    if(!shot_index_valid(index)) {
+        shot_index_close(index);
+        return false;
+    }
+    return true;
+}
+
+/* Shot that passes through the most of the given coin cells, -1 when none does.
+   'covered' receives the number of those cells it passes through */
+inline int shot_index_best (const ShotIndex& index, const std::vector<int>& cells, int& covered)
+{
+    covered = 0;
+    if(index.map == NULL)
+        return -1;
+    std::vector<uint16_t> hits(index.header->num_shots, 0);
+    int best = -1;
+    for(size_t c=0;c<cells.size();c++)
+    {
+        if(cells[c] < 0)
+            continue;
+        for(uint32_t p=index.offsets[cells[c]]; p<index.offsets[cells[c]+1]; p++)
+        {
+            int shot = index.postings[p];
+            hits[shot]++;
+            if(hits[shot] > covered || (hits[shot] == covered && shot < best))
+            {
+                covered = hits[shot];
+                best = shot;
+            }
+        }
+    }
+    return best;
+}
+
+#endif
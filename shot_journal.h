@@ -0,0 +1,502 @@
+#ifndef SHOT_JOURNAL_H
+#define SHOT_JOURNAL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "game_env.h"
+
+/****************************************
+ * Shot journal                         *
+ ****************************************/
+/* Every shot and how it ended, appended to a binary file for offline analysis.
+   The game thread only copies a record into a pending list, a writer thread turns the
+   list into a block and appends it with a single write followed by fdatasync.
+
+   The file is a sequence of self-contained blocks: ShotJournalBlock, then one column
+   per field, each column 'count' values long and padded to 8 bytes. The checksum covers
+   the columns, so a block cut short by a crash fails it. Readers stop at the first bad
+   block and the writer truncates the file back to it before appending again. A block that
+   fails to write is kept and retried with the shots that come after it */
+
+#define SHOT_JOURNAL_MAGIC "SHOTJBLK"
+#define SHOT_JOURNAL_VERSION 1
+#define SHOT_JOURNAL_BLOCK_SHOTS 4096    // a block is written once this many shots are pending
+#define SHOT_JOURNAL_FLUSH_MS 1000       // or when the oldest pending shot is this old
+#define SHOT_JOURNAL_TICKS_PER_SECOND 60
+
+enum ShotOutcome { SHOT_RESTED, SHOT_TRAPPED, SHOT_REFIRED, SHOT_UNDONE, SHOT_QUIT, SHOT_LOST, NUM_SHOT_OUTCOMES };
+static const char* shot_outcome_names[NUM_SHOT_OUTCOMES] = { "rested", "trapped", "refired", "undone", "quit", "lost" };
+
+struct ShotRecord {
+    float rotation;     // canon_rotation in degrees
+    float power;        // power_meter
+    uint16_t bounces;
+    uint16_t coins;     // coins collected during the flight
+    uint32_t ticks;     // physics ticks from the shot to its outcome
+    uint8_t outcome;    // ShotOutcome
+};
+typedef struct ShotRecord ShotRecord;
+
+struct ShotJournalBlock {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t bytes;     // size of the columns that follow
+    uint64_t checksum;  // FNV-1a over the columns
+};
+typedef struct ShotJournalBlock ShotJournalBlock;
+
+/* Columns of a block in file order */
+struct ShotJournalColumns {
+    const float* rotation;
+    const float* power;
+    const uint16_t* bounces;
+    const uint16_t* coins;
+    const uint32_t* ticks;
+    const uint8_t* outcome;
+};
+typedef struct ShotJournalColumns ShotJournalColumns;
+
+inline size_t shot_journal_pad (size_t bytes) { return (bytes + 7) & ~(size_t)7; }
+
+inline size_t shot_journal_columns_bytes (uint32_t count)
+{
+    return 2*shot_journal_pad(count*sizeof(float)) + 2*shot_journal_pad(count*sizeof(uint16_t)) +
+           shot_journal_pad(count*sizeof(uint32_t)) + shot_journal_pad(count*sizeof(uint8_t));
+}
+
+inline uint64_t shot_journal_checksum (const uint8_t* data, size_t size)
+{
+    uint64_t hash = 1469598103934665603ull;
+    for(size_t b=0;b<size;b++)
+        hash = (hash ^ data[b]) * 1099511628211ull;
+    return hash;
+}
+
+inline ShotJournalColumns shot_journal_columns (const uint8_t* data, uint32_t count)
+{
+    ShotJournalColumns c;
+    c.rotation = (const float*) data;                data += shot_journal_pad(count*sizeof(float));
+    c.power = (const float*) data;                   data += shot_journal_pad(count*sizeof(float));
+    c.bounces = (const uint16_t*) data;              data += shot_journal_pad(count*sizeof(uint16_t));
+    c.coins = (const uint16_t*) data;                data += shot_journal_pad(count*sizeof(uint16_t));
+    c.ticks = (const uint32_t*) data;                data += shot_journal_pad(count*sizeof(uint32_t));
+    c.outcome = (const uint8_t*) data;
+    return c;
+}
+
+/* Header of the block at 'offset' when it is complete and intact, NULL otherwise */
+inline const ShotJournalBlock* shot_journal_block_at (const uint8_t* file, size_t size, size_t offset)
+{
+    if(size - offset < sizeof(ShotJournalBlock))
+        return NULL;
+    const ShotJournalBlock* block = (const ShotJournalBlock*) (file + offset);
+    if(memcmp(block->magic, SHOT_JOURNAL_MAGIC, 8) != 0 || block->version != SHOT_JOURNAL_VERSION ||
+       block->bytes != shot_journal_columns_bytes(block->count) ||
+       block->bytes > size - offset - sizeof(ShotJournalBlock))
+        return NULL;
+    if(shot_journal_checksum((const uint8_t*) (block + 1), block->bytes) != block->checksum)
+        return NULL;
+    return block;
+}
+
+/* Length of the intact prefix of a journal file */
+inline size_t shot_journal_valid_bytes (const uint8_t* file, size_t size)
+{
+    size_t offset = 0;
+    while(const ShotJournalBlock* block = shot_journal_block_at(file, size, offset))
+        offset += sizeof(ShotJournalBlock) + block->bytes;
+    return offset;
+}
+
+class ShotJournalWriter {
+public:
+    ShotJournalWriter () : fd_(-1), bytes_written_(0), torn_(false), stop_(false), shots_(0), blocks_(0), bytes_(0), failures_(0), lost_(0), recovered_(0) {}
+    ~ShotJournalWriter () { close(); }
+
+    ShotJournalWriter (const ShotJournalWriter&) = delete;
+    ShotJournalWriter& operator= (const ShotJournalWriter&) = delete;
+
+    /* Opens 'path' for appending, dropping a block a crash left half written */
+    bool open (const char* path)
+    {
+        close();
+        int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        size_t valid = 0;
+        if(st.st_size > 0)
+        {
+            void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map == MAP_FAILED) {
+                ::close(fd);
+                return false;
+            }
+            valid = shot_journal_valid_bytes((const uint8_t*) map, st.st_size);
+            munmap(map, st.st_size);
+        }
+        if(valid < (size_t)st.st_size && ftruncate(fd, valid) != 0) {
+            ::close(fd);
+            return false;
+        }
+        recovered_ = st.st_size - valid;
+        lseek(fd, valid, SEEK_SET);
+        fd_ = fd;
+        bytes_written_ = valid;
+        torn_ = false;
+        stop_ = false;
+        writer_ = std::thread(&ShotJournalWriter::run, this);
+        return true;
+    }
+
+    /* Writes what is pending and stops the writer thread */
+    void close ()
+    {
+        if(fd_ < 0)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    bool is_open () const { return fd_ >= 0; }
+
+    /* Called from the game thread, never touches the file */
+    void append (const ShotRecord& shot)
+    {
+        if(fd_ < 0)
+            return;
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(pending_.empty())
+                oldest_ = std::chrono::steady_clock::now();
+            pending_.push_back(shot);
+            full = pending_.size() >= SHOT_JOURNAL_BLOCK_SHOTS;
+        }
+        if(full)
+            wake_.notify_one();
+    }
+
+    long shots () const { return shots_; }
+    long blocks () const { return blocks_; }
+    long bytes () const { return bytes_; }
+    long failures () const { return failures_; }
+    long lost () const { return lost_; }        // shots still failing to write when the journal closed
+    size_t recovered () const { return recovered_; }
+
+private:
+    void run ()
+    {
+        std::vector<ShotRecord> batch;
+        std::vector<uint8_t> block;
+        while(true)
+        {
+            bool stop;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait_for(lock, std::chrono::milliseconds(SHOT_JOURNAL_FLUSH_MS), [this] {
+                    return stop_ || pending_.size() >= SHOT_JOURNAL_BLOCK_SHOTS ||
+                           (!pending_.empty() && std::chrono::steady_clock::now() - oldest_ >= std::chrono::milliseconds(SHOT_JOURNAL_FLUSH_MS));
+                });
+                stop = stop_;
+                // a batch that failed to write goes out again with the shots since
+                batch.insert(batch.end(), pending_.begin(), pending_.end());
+                pending_.clear();
+            }
+            if(!batch.empty())
+            {
+                encode(batch, block);
+                if(write_all(&block[0], block.size()) && fdatasync(fd_) == 0)
+                {
+                    shots_ += batch.size();
+                    blocks_++;
+                    bytes_ += block.size();
+                    bytes_written_ += block.size();
+                    batch.clear();
+                    // a tail an earlier failure could not cut off now follows a valid block
+                    if(torn_ && ftruncate(fd_, bytes_written_) == 0)
+                        torn_ = false;
+                }
+                else
+                {
+                    // cut the torn block off again so later blocks still follow a valid prefix,
+                    // when that fails too the next block overwrites it
+                    failures_++;
+                    torn_ = ftruncate(fd_, bytes_written_) != 0;
+                    lseek(fd_, bytes_written_, SEEK_SET);
+                }
+            }
+            if(stop)
+            {
+                lost_ += batch.size();
+                return;
+            }
+        }
+    }
+
+    /* Transposes the records into the column layout behind a block header */
+    static void encode (const std::vector<ShotRecord>& batch, std::vector<uint8_t>& block)
+    {
+        uint32_t count = batch.size();
+        block.assign(sizeof(ShotJournalBlock) + shot_journal_columns_bytes(count), 0);
+        uint8_t* data = &block[sizeof(ShotJournalBlock)];
+        uint8_t* column = data;
+        for(uint32_t s=0;s<count;s++) memcpy(column + s*sizeof(float), &batch[s].rotation, sizeof(float));
+        column += shot_journal_pad(count*sizeof(float));
+        for(uint32_t s=0;s<count;s++) memcpy(column + s*sizeof(float), &batch[s].power, sizeof(float));
+        column += shot_journal_pad(count*sizeof(float));
+        for(uint32_t s=0;s<count;s++) memcpy(column + s*sizeof(uint16_t), &batch[s].bounces, sizeof(uint16_t));
+        column += shot_journal_pad(count*sizeof(uint16_t));
+        for(uint32_t s=0;s<count;s++) memcpy(column + s*sizeof(uint16_t), &batch[s].coins, sizeof(uint16_t));
+        column += shot_journal_pad(count*sizeof(uint16_t));
+        for(uint32_t s=0;s<count;s++) memcpy(column + s*sizeof(uint32_t), &batch[s].ticks, sizeof(uint32_t));
+        column += shot_journal_pad(count*sizeof(uint32_t));
+        for(uint32_t s=0;s<count;s++) column[s] = batch[s].outcome;
+
+        ShotJournalBlock header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SHOT_JOURNAL_MAGIC, 8);
+        header.version = SHOT_JOURNAL_VERSION;
+        header.count = count;
+        header.bytes = shot_journal_columns_bytes(count);
+        header.checksum = shot_journal_checksum(data, header.bytes);
+        memcpy(&block[0], &header, sizeof(header));
+    }
+
+    bool write_all (const uint8_t* data, size_t size)
+    {
+        while(size > 0)
+        {
+            ssize_t done = ::write(fd_, data, size);
+            if(done <= 0)
+                return false;
+            data += done;
+            size -= done;
+        }
+        return true;
+    }
+
+    int fd_;
+    off_t bytes_written_;   // end of the last block that made it to disk
+    bool torn_;             // the file still runs on past bytes_written_
+    std::thread writer_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_;
+    std::vector<ShotRecord> pending_;
+    std::chrono::steady_clock::time_point oldest_;
+    std::atomic<long> shots_, blocks_, bytes_, failures_, lost_;
+    size_t recovered_;
+};
+
+/****************************************
+ * Journal report                       *
+ ****************************************/
+
+#define SHOT_JOURNAL_ANGLE_BUCKETS 18   // 10 degrees each
+#define SHOT_JOURNAL_MAX_BOUNCES 16     // the last bucket counts this many and more
+#define SHOT_JOURNAL_MAX_COINS 8
+
+struct ShotJournalStats {
+    long shots;
+    long invalid;                           // records with an unknown outcome, left out of everything else
+    long outcomes[NUM_SHOT_OUTCOMES];
+    long coins;
+    long bounces;
+    double power;
+    long rest_shots;                        // shots that came to rest, time to rest is averaged over them
+    double rest_ticks;
+    long angle_shots[SHOT_JOURNAL_ANGLE_BUCKETS];
+    long angle_coins[SHOT_JOURNAL_ANGLE_BUCKETS];
+    double angle_power[SHOT_JOURNAL_ANGLE_BUCKETS];
+    long bounce_histogram[SHOT_JOURNAL_MAX_BOUNCES+1];
+    long coin_histogram[SHOT_JOURNAL_MAX_COINS+1];
+};
+typedef struct ShotJournalStats ShotJournalStats;
+
+/* Folds one block into 'stats', a column at a time */
+inline void shot_journal_accumulate (const ShotJournalBlock* block, ShotJournalStats& stats)
+{
+    uint32_t n = block->count;
+    ShotJournalColumns c = shot_journal_columns((const uint8_t*) (block + 1), n);
+    for(uint32_t s=0;s<n;s++)
+        if(c.outcome[s] < NUM_SHOT_OUTCOMES)
+        {
+            stats.shots++;
+            stats.outcomes[c.outcome[s]]++;
+        }
+        else
+            stats.invalid++;
+    for(uint32_t s=0;s<n;s++)
+    {
+        if(c.outcome[s] >= NUM_SHOT_OUTCOMES)
+            continue;
+        stats.coins += c.coins[s];
+        stats.coin_histogram[std::min<int>(c.coins[s], SHOT_JOURNAL_MAX_COINS)]++;
+    }
+    for(uint32_t s=0;s<n;s++)
+    {
+        if(c.outcome[s] >= NUM_SHOT_OUTCOMES)
+            continue;
+        stats.bounces += c.bounces[s];
+        stats.bounce_histogram[std::min<int>(c.bounces[s], SHOT_JOURNAL_MAX_BOUNCES)]++;
+    }
+    for(uint32_t s=0;s<n;s++)
+        if(c.outcome[s] < NUM_SHOT_OUTCOMES)
+            stats.power += c.power[s];
+    for(uint32_t s=0;s<n;s++)
+        if(c.outcome[s] == SHOT_RESTED)
+        {
+            stats.rest_shots++;
+            stats.rest_ticks += c.ticks[s];
+        }
+    for(uint32_t s=0;s<n;s++)
+    {
+        if(c.outcome[s] >= NUM_SHOT_OUTCOMES)
+            continue;
+        int bucket = std::min(std::max((int)(c.rotation[s]/10), 0), SHOT_JOURNAL_ANGLE_BUCKETS-1);
+        stats.angle_shots[bucket]++;
+        stats.angle_coins[bucket] += c.coins[s];
+        stats.angle_power[bucket] += c.power[s];
+    }
+}
+
+inline void shot_journal_merge (ShotJournalStats& into, const ShotJournalStats& from)
+{
+    into.shots += from.shots;
+    into.invalid += from.invalid;
+    for(int o=0;o<NUM_SHOT_OUTCOMES;o++) into.outcomes[o] += from.outcomes[o];
+    into.coins += from.coins;
+    into.bounces += from.bounces;
+    into.power += from.power;
+    into.rest_shots += from.rest_shots;
+    into.rest_ticks += from.rest_ticks;
+    for(int b=0;b<SHOT_JOURNAL_ANGLE_BUCKETS;b++)
+    {
+        into.angle_shots[b] += from.angle_shots[b];
+        into.angle_coins[b] += from.angle_coins[b];
+        into.angle_power[b] += from.angle_power[b];
+    }
+    for(int b=0;b<=SHOT_JOURNAL_MAX_BOUNCES;b++) into.bounce_histogram[b] += from.bounce_histogram[b];
+    for(int b=0;b<=SHOT_JOURNAL_MAX_COINS;b++) into.coin_histogram[b] += from.coin_histogram[b];
+}
+
+/* Maps the journal read-only and aggregates every intact block, blocks are spread over
+   'threads'. Returns false when the file cannot be read, 'ignored' receives the size of
+   a torn tail */
+inline bool shot_journal_aggregate (const char* path, int threads, ShotJournalStats& stats, size_t& ignored)
+{
+    memset(&stats, 0, sizeof(stats));
+    ignored = 0;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    if(st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return false;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    // block boundaries come from the headers, checksums are verified by the workers
+    const uint8_t* file = (const uint8_t*) map;
+    std::vector<const ShotJournalBlock*> blocks;
+    size_t offset = 0;
+    while(st.st_size - offset >= sizeof(ShotJournalBlock))
+    {
+        const ShotJournalBlock* block = (const ShotJournalBlock*) (file + offset);
+        if(memcmp(block->magic, SHOT_JOURNAL_MAGIC, 8) != 0 || block->version != SHOT_JOURNAL_VERSION ||
+           block->bytes != shot_journal_columns_bytes(block->count) ||
+           block->bytes > st.st_size - offset - sizeof(ShotJournalBlock))
+            break;
+        blocks.push_back(block);
+        offset += sizeof(ShotJournalBlock) + block->bytes;
+    }
+
+    std::vector<ShotJournalStats> partial(blocks.size());
+    std::vector<char> intact(blocks.size(), 0);
+    ThreadPool pool(threads);
+    pool.run(blocks.size(), [&](int b) {
+        memset(&partial[b], 0, sizeof(ShotJournalStats));
+        if(shot_journal_checksum((const uint8_t*) (blocks[b] + 1), blocks[b]->bytes) != blocks[b]->checksum)
+            return;
+        intact[b] = 1;
+        shot_journal_accumulate(blocks[b], partial[b]);
+    });
+    // everything after the first bad block is ignored, just like the writer would truncate it
+    size_t valid = 0;
+    for(size_t b=0;b<blocks.size() && intact[b];b++)
+    {
+        shot_journal_merge(stats, partial[b]);
+        valid += sizeof(ShotJournalBlock) + blocks[b]->bytes;
+    }
+    ignored = st.st_size - valid;
+    munmap(map, st.st_size);
+    return true;
+}
+
+inline void shot_journal_print (const ShotJournalStats& stats)
+{
+    long n = stats.shots;
+    printf("Shots: %ld\n", n);
+    if(stats.invalid)
+        printf("Skipped %ld records with an unknown outcome\n", stats.invalid);
+    if(n == 0)
+        return;
+    for(int o=0;o<NUM_SHOT_OUTCOMES;o++)
+        printf("  %-10s %10ld %6.2f%%\n", shot_outcome_names[o], stats.outcomes[o], 100.0*stats.outcomes[o]/n);
+    printf("Coins per shot %.3f, bounces per shot %.3f, mean power %.2f\n",
+           (double)stats.coins/n, (double)stats.bounces/n, stats.power/n);
+    if(stats.rest_shots)
+        printf("Time to rest %.2f s on average over %ld shots\n",
+               stats.rest_ticks/stats.rest_shots/SHOT_JOURNAL_TICKS_PER_SECOND, stats.rest_shots);
+    printf("  %-9s %10s %12s %10s\n", "angle", "shots", "coins/shot", "power");
+    for(int b=0;b<SHOT_JOURNAL_ANGLE_BUCKETS;b++)
+    {
+        long shots = stats.angle_shots[b];
+        if(shots)
+            printf("  %3d-%-5d %10ld %12.3f %10.2f\n", b*10, b*10+10, shots,
+                   (double)stats.angle_coins[b]/shots, stats.angle_power[b]/shots);
+    }
+    printf("  %-9s %10s\n", "bounces", "shots");
+    for(int b=0;b<=SHOT_JOURNAL_MAX_BOUNCES;b++)
+        if(stats.bounce_histogram[b])
+            printf("  %2d%-7s %10ld\n", b, b == SHOT_JOURNAL_MAX_BOUNCES ? "+" : "", stats.bounce_histogram[b]);
+    printf("  %-9s %10s\n", "coins", "shots");
+    for(int b=0;b<=SHOT_JOURNAL_MAX_COINS;b++)
+        if(stats.coin_histogram[b])
+            printf("  %2d%-7s %10ld\n", b, b == SHOT_JOURNAL_MAX_COINS ? "+" : "", stats.coin_histogram[b]);
+}
+
+#endif
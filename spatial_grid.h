@@ -0,0 +1,89 @@
+#ifndef SPATIAL_GRID_H
+#define SPATIAL_GRID_H
+
+#include <stdint.h>
+#include <math.h>
+#include <unordered_map>
+#include <vector>
+
+/****************************************
+ * Uniform grid of points               *
+ ****************************************/
+/* Points are filed under the square cell of side 'cell' they fall in. The cells live in a
+   hash map, so the grid has no bounds and only costs what is occupied. A query visits the
+   cells a box overlaps, or every occupied cell when that is fewer, so pick a cell near the
+   size of the boxes asked for */
+
+class PointGrid {
+public:
+    explicit PointGrid (float cell) : cell_(cell), inv_cell_(1/cell), size_(0) {}
+
+    void clear ()
+    {
+        cells_.clear();
+        size_ = 0;
+    }
+
+    void insert (int id, float x, float y)
+    {
+        cells_[key(cell_of(x), cell_of(y))].push_back(id);
+        size_++;
+    }
+
+    /* Calls fn(id) for every point in the cells the box overlaps, a superset of the points in it */
+    template <typename F>
+    void query (float minx, float miny, float maxx, float maxy, F fn) const
+    {
+        int x0 = cell_of(minx), x1 = cell_of(maxx);
+        int y0 = cell_of(miny), y1 = cell_of(maxy);
+        if((double)(x1 - x0 + 1)*(y1 - y0 + 1) > cells_.size())
+        {
+            for(Cells::const_iterator it=cells_.begin(); it!=cells_.end(); it++)
+            {
+                int cx = (int32_t)(it->first >> 32), cy = (int32_t)(uint32_t)it->first;
+                if(cx >= x0 && cx <= x1 && cy >= y0 && cy <= y1)
+                    visit(it->second, fn);
+            }
+            return;
+        }
+        for(int cy=y0; cy<=y1; cy++)
+            for(int cx=x0; cx<=x1; cx++)
+            {
+                Cells::const_iterator it = cells_.find(key(cx, cy));
+                if(it != cells_.end())
+                    visit(it->second, fn);
+            }
+    }
+
+    size_t size () const { return size_; }
+    size_t cells () const { return cells_.size(); }
+
+    /* Storage of the ids and, roughly, of the map's nodes and buckets */
+    size_t bytes () const
+    {
+        size_t bytes = cells_.bucket_count()*sizeof(void*);
+        for(Cells::const_iterator it=cells_.begin(); it!=cells_.end(); it++)
+            bytes += it->second.capacity()*sizeof(int) + sizeof(Cells::value_type) + sizeof(void*);
+        return bytes;
+    }
+
+private:
+    typedef std::unordered_map<uint64_t, std::vector<int> > Cells;
+
+    int cell_of (float v) const { return (int)floorf(v*inv_cell_); }
+    static uint64_t key (int cx, int cy) { return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy; }
+
+    template <typename F>
+    static void visit (const std::vector<int>& ids, F& fn)
+    {
+        for(size_t i=0;i<ids.size();i++)
+            fn(ids[i]);
+    }
+
+    float cell_;
+    float inv_cell_;
+    size_t size_;
+    Cells cells_;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef TRACE_ZONES_H
+#define TRACE_ZONES_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/****************************************
+ * Timeline trace zones                 *
+ ****************************************/
+/* A TraceZone records when a scope started and how long it took, on the thread it ran on.
+   Every thread appends to its own TraceBuffer, blocks of events that only it writes, and
+   publishes each finished event with a release store of its count. Recording takes no lock
+   and write() reads the buffers while the threads go on. The file is Chrome trace-event
+   JSON, open it in chrome://tracing or ui.perfetto.dev. Nothing is recorded until enable(),
+   a zone then costs two clock reads */
+
+#define TRACE_BLOCK_EVENTS 4096
+#define TRACE_MAX_BLOCKS 256        // a million events per thread, later ones are dropped
+
+struct TraceEvent {
+    const char* name;       // only the pointer is kept, give zones string literals
+    uint64_t begin_ns;
+    uint64_t duration_ns;
+};
+
+class TraceBuffer {
+public:
+    explicit TraceBuffer (int tid) : tid_(tid), count_(0), dropped_(0)
+    {
+        for(int b=0;b<TRACE_MAX_BLOCKS;b++)
+            blocks_[b].store(NULL, std::memory_order_relaxed);
+    }
+    ~TraceBuffer ()
+    {
+        for(int b=0;b<TRACE_MAX_BLOCKS;b++)
+            delete[] blocks_[b].load(std::memory_order_relaxed);
+    }
+
+    /* Only called from the thread the buffer belongs to */
+    void record (const char* name, uint64_t begin_ns, uint64_t duration_ns)
+    {
+        size_t n = count_.load(std::memory_order_relaxed);
+        size_t b = n / TRACE_BLOCK_EVENTS;
+        if(b >= TRACE_MAX_BLOCKS)
+        {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        TraceEvent* block = blocks_[b].load(std::memory_order_relaxed);
+        if(block == NULL)
+        {
+            block = new TraceEvent[TRACE_BLOCK_EVENTS];
+            blocks_[b].store(block, std::memory_order_release);
+        }
+        TraceEvent& event = block[n % TRACE_BLOCK_EVENTS];
+        event.name = name;
+        event.begin_ns = begin_ns;
+        event.duration_ns = duration_ns;
+        count_.store(n + 1, std::memory_order_release);
+    }
+
+    /* Events below count() are complete and can be read from any thread */
+    size_t count () const { return count_.load(std::memory_order_acquire); }
+    const TraceEvent& event (size_t i) const
+    {
+        return blocks_[i / TRACE_BLOCK_EVENTS].load(std::memory_order_acquire)[i % TRACE_BLOCK_EVENTS];
+    }
+    size_t dropped () const { return dropped_.load(std::memory_order_relaxed); }
+    int tid () const { return tid_; }
+
+    std::string name;
+
+private:
+    int tid_;
+    std::atomic<size_t> count_;
+    std::atomic<size_t> dropped_;
+    std::atomic<TraceEvent*> blocks_[TRACE_MAX_BLOCKS];
+};
+
+class Tracer {
+public:
+    Tracer () : enabled_(false), epoch_(std::chrono::steady_clock::now()) {}
+    ~Tracer ()
+    {
+        for(size_t i=0;i<buffers_.size();i++)
+            delete buffers_[i];
+    }
+
+    void enable () { enabled_.store(true, std::memory_order_relaxed); }
+    bool enabled () const { return enabled_.load(std::memory_order_relaxed); }
+
+    uint64_t now_ns () const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch_).count();
+    }
+
+    /* The calling thread's buffer, made on its first event. The lock is only taken then */
+    TraceBuffer& buffer ()
+    {
+        static thread_local TraceBuffer* mine = NULL;
+        if(mine == NULL)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            mine = new TraceBuffer(buffers_.size() + 1);
+            buffers_.push_back(mine);
+        }
+        return *mine;
+    }
+
+    /* Shown for the calling thread instead of "thread N" */
+    void name_thread (const char* name) { buffer().name = name; }
+
+    size_t events ()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t n = 0;
+        for(size_t i=0;i<buffers_.size();i++)
+            n += buffers_[i]->count();
+        return n;
+    }
+
+    size_t dropped ()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t n = 0;
+        for(size_t i=0;i<buffers_.size();i++)
+            n += buffers_[i]->dropped();
+        return n;
+    }
+
+    /* Writes every event recorded so far as complete ("X") events, times in microseconds.
+       Returns false when the file cannot be written */
+    bool write (const char* path)
+    {
+        FILE* file = fopen(path, "w");
+        if(file == NULL)
+            return false;
+        std::lock_guard<std::mutex> lock(mutex_);
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"sample2D\"}}");
+        for(size_t i=0;i<buffers_.size();i++)
+        {
+            const TraceBuffer& buffer = *buffers_[i];
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", buffer.tid());
+            if(buffer.name.empty())
+                fprintf(file, "\"thread %d\"}}", buffer.tid());
+            else
+            {
+                write_string(file, buffer.name.c_str());
+                fprintf(file, "}}");
+            }
+            size_t count = buffer.count();
+            for(size_t e=0;e<count;e++)
+            {
+                const TraceEvent& event = buffer.event(e);
+                fprintf(file, ",\n{\"name\":");
+                write_string(file, event.name);
+                fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        buffer.tid(), event.begin_ns/1000.0, event.duration_ns/1000.0);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        return fclose(file) == 0;
+    }
+
+private:
+    static void write_string (FILE* file, const char* s)
+    {
+        fputc('"', file);
+        for(; *s; s++)
+        {
+            if(*s == '"' || *s == '\\')
+                fputc('\\', file);
+            if((unsigned char)*s >= 0x20)
+                fputc(*s, file);
+        }
+        fputc('"', file);
+    }
+
+    std::atomic<bool> enabled_;
+    std::chrono::steady_clock::time_point epoch_;
+    std::mutex mutex_;                      // guards buffers_, threads only take it for their first event
+    std::vector<TraceBuffer*> buffers_;
+};
+
+static Tracer tracer;
+
+/* Times the scope it lives in, or until end(). next() ends it and starts the next stage of a
+   function at the same instant */
+class TraceZone {
+public:
+    explicit TraceZone (const char* name) : name_(tracer.enabled() ? name : NULL), begin_ns_(name_ ? tracer.now_ns() : 0) {}
+    ~TraceZone () { end(); }
+
+    void end ()
+    {
+        if(name_ == NULL)
+            return;
+        tracer.buffer().record(name_, begin_ns_, tracer.now_ns() - begin_ns_);
+        name_ = NULL;
+    }
+
+    void next (const char* name)
+    {
+        if(!tracer.enabled())
+        {
+            name_ = NULL;
+            return;
+        }
+        uint64_t now = tracer.now_ns();
+        if(name_)
+            tracer.buffer().record(name_, begin_ns_, now - begin_ns_);
+        name_ = name;
+        begin_ns_ = now;
+    }
+
+private:
+    TraceZone (const TraceZone&);
+    TraceZone& operator= (const TraceZone&);
+
+    const char* name_;
+    uint64_t begin_ns_;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef WORLD_CHUNKS_H
+#define WORLD_CHUNKS_H
+
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "collision.h"
+
+/****************************************
+ * Streamed world chunks                *
+ ****************************************/
+/* A long level is cut into chunks of a fixed width along x, each holding its coins, its
+   colliders and all its boxes as one triangle list. A chunk is made again from the level seed
+   and its index whenever it comes back, so while it is away only the coins it lost are kept,
+   a bit each. stream() brings in the chunks around the focus (the ball and the view) and one
+   more either side, drops chunks further than WORLD_KEEP_CHUNKS away and, to stay inside the
+   memory budget, lets the furthest go first. The caller uploads a chunk's mesh in on_load,
+   after which the chunk drops its copy, and frees it in on_evict */
+
+#define WORLD_MAX_CHUNK_COINS 64
+#define WORLD_PREFETCH_CHUNKS 1
+#define WORLD_KEEP_CHUNKS 3
+
+enum WorldBoxKind { WORLD_BLOCK, WORLD_GROUND, NUM_WORLD_BOX_KINDS };
+
+struct WorldSurface {
+    float ex, ey;           // friction, as obstacle_add takes it
+    float rgb[3];
+};
+typedef struct WorldSurface WorldSurface;
+
+struct WorldLayout {
+    uint64_t seed;
+    float origin_x;         // left edge of chunk 0
+    float chunk_width;
+    int chunks;
+    int coins;              // per chunk, at most WORLD_MAX_CHUNK_COINS
+    int blocks;             // per chunk
+    float min_y, max_y;     // band the coins and block pivots are scattered over
+    float block_w, block_h;
+    float ground_from;      // the chunks lay their own ground right of this
+    float ground_bottom, ground_top;
+    WorldSurface surfaces[NUM_WORLD_BOX_KINDS];
+};
+typedef struct WorldLayout WorldLayout;
+
+struct WorldChunk {
+    int index;
+    float x0, x1;
+    float min_x, max_x;             // of the mesh, rotated blocks reach over the edges
+    float min_y, max_y;
+    std::vector<float> coin_x, coin_y;
+    uint64_t alive;                 // a bit per coin still in play
+    ObstacleSet colliders;
+    std::vector<float> positions;   // xyz per vertex, empty once uploaded
+    std::vector<float> colors;      // rgb per vertex
+    int vertices;
+    void* mesh;                     // the caller's handle to the uploaded mesh
+    size_t bytes;                   // held here and by the mesh
+};
+typedef struct WorldChunk WorldChunk;
+
+class ChunkedWorld {
+public:
+    ChunkedWorld () : budget_(0), bytes_(0), peak_bytes_(0), estimate_(0), loads_(0), evictions_(0),
+                      budget_evictions_(0), over_budget_(0), collected_count_(0)
+    {
+        layout_.chunks = 0;
+    }
+
+    ~ChunkedWorld ()
+    {
+        for(size_t r=0;r<resident_.size();r++)
+            delete resident_[r];
+    }
+
+    ChunkedWorld (const ChunkedWorld&) = delete;
+    ChunkedWorld& operator= (const ChunkedWorld&) = delete;
+
+    void configure (const WorldLayout& layout, size_t budget_bytes, const std::function<void(WorldChunk&)>& on_load,
+                    const std::function<void(WorldChunk&)>& on_evict)
+    {
+        layout_ = layout;
+        layout_.coins = std::min(layout_.coins, WORLD_MAX_CHUNK_COINS);
+        budget_ = budget_bytes;
+        on_load_ = on_load;
+        on_evict_ = on_evict;
+        collected_.assign(layout_.chunks, 0);
+    }
+
+    bool active () const { return layout_.chunks > 0; }
+    const WorldLayout& layout () const { return layout_; }
+    float end_x () const { return layout_.origin_x + layout_.chunks*layout_.chunk_width; }
+
+    /* Streams in the chunks overlapping [lo,hi] and their neighbours, drops the rest as needed */
+    void stream (float lo, float hi)
+    {
+        if(!active())
+            return;
+        int first = chunk_index(lo), last = chunk_index(hi);
+
+        // out of reach
+        for(size_t r=0;r<resident_.size();)
+            if(distance(resident_[r]->index, first, last) > WORLD_KEEP_CHUNKS)
+                evict(r);
+            else
+                r++;
+
+        // nearest first, so the budget goes to the chunks that matter most
+        for(int d=0; d<=WORLD_PREFETCH_CHUNKS; d++)
+            for(int i=first-d; i<=last+d; i++)
+            {
+                if(distance(i, first, last) != d || i < 0 || i >= layout_.chunks || find(i) >= 0)
+                    continue;
+                while(bytes_ + estimate_ > budget_ && evict_furthest(first, last, d))
+                    budget_evictions_++;
+                // the chunks the focus is on load whatever the budget says, the neighbours wait
+                if(d > 0 && bytes_ + estimate_ > budget_)
+                    continue;
+                load(i);
+            }
+
+        while(bytes_ > budget_ && evict_furthest(first, last, 0))
+            budget_evictions_++;
+        if(bytes_ > budget_)
+            over_budget_++;
+    }
+
+    /* Resident chunks overlapping [lo,hi] */
+    void chunks_in (float lo, float hi, std::vector<WorldChunk*>& out) const
+    {
+        out.clear();
+        for(size_t r=0;r<resident_.size();r++)
+            if(resident_[r]->max_x >= lo && resident_[r]->min_x <= hi)
+                out.push_back(resident_[r]);
+    }
+
+    const std::vector<WorldChunk*>& resident () const { return resident_; }
+
+    /* Takes coin 'c' of 'chunk' out of play for good, it stays gone when the chunk comes back */
+    void collect (WorldChunk& chunk, int c)
+    {
+        chunk.alive &= ~((uint64_t)1 << c);
+        collected_[chunk.index] |= (uint64_t)1 << c;
+        collected_count_++;
+    }
+
+    size_t bytes () const { return bytes_; }
+    size_t peak_bytes () const { return peak_bytes_; }
+    size_t budget () const { return budget_; }
+    long loads () const { return loads_; }
+    long evictions () const { return evictions_; }
+    long budget_evictions () const { return budget_evictions_; }
+    long over_budget () const { return over_budget_; }
+    long collected () const { return collected_count_; }
+
+private:
+    int chunk_index (float x) const { return (int)floorf((x - layout_.origin_x)/layout_.chunk_width); }
+
+    /* Chunks between 'index' and the focus chunks [first,last] */
+    static int distance (int index, int first, int last)
+    {
+        return index < first ? first - index : index > last ? index - last : 0;
+    }
+
+    int find (int index) const
+    {
+        for(size_t r=0;r<resident_.size();r++)
+            if(resident_[r]->index == index)
+                return r;
+        return -1;
+    }
+
+    /* Drops the resident chunk furthest from the focus if it is further than 'beyond' */
+    bool evict_furthest (int first, int last, int beyond)
+    {
+        int furthest = -1, worst = beyond;
+        for(size_t r=0;r<resident_.size();r++)
+        {
+            int d = distance(resident_[r]->index, first, last);
+            if(d > worst)
+            {
+                worst = d;
+                furthest = r;
+            }
+        }
+        if(furthest < 0)
+            return false;
+        evict(furthest);
+        return true;
+    }
+
+    void evict (size_t r)
+    {
+        WorldChunk* chunk = resident_[r];
+        if(on_evict_)
+            on_evict_(*chunk);
+        bytes_ -= chunk->bytes;
+        delete chunk;
+        resident_.erase(resident_.begin() + r);
+        evictions_++;
+    }
+
+    void load (int index)
+    {
+        WorldChunk* chunk = new WorldChunk();
+        build(*chunk, index);
+        chunk->mesh = NULL;
+        if(on_load_)
+            on_load_(*chunk);
+        // the mesh lives with the caller now, only its size is still counted here
+        size_t mesh_bytes = (chunk->positions.size() + chunk->colors.size())*sizeof(float);
+        std::vector<float>().swap(chunk->positions);
+        std::vector<float>().swap(chunk->colors);
+        chunk->bytes = sizeof(WorldChunk) + mesh_bytes + (chunk->coin_x.capacity() + chunk->coin_y.capacity())*sizeof(float)
+                     + obstacle_bytes(chunk->colliders);
+        bytes_ += chunk->bytes;
+        peak_bytes_ = std::max(peak_bytes_, bytes_);
+        estimate_ = std::max(estimate_, chunk->bytes);
+        resident_.push_back(chunk);
+        loads_++;
+    }
+
+    static size_t obstacle_bytes (const ObstacleSet& set)
+    {
+        return (set.cx.capacity() + set.cy.capacity() + set.hx.capacity() + set.hy.capacity() + set.cosr.capacity()
+              + set.sinr.capacity() + set.px.capacity() + set.py.capacity() + set.vx.capacity() + set.vy.capacity()
+              + set.spin.capacity() + set.ex.capacity() + set.ey.capacity() + set.scratch.capacity())*sizeof(float)
+              + set.flags.capacity()*sizeof(int);
+    }
+
+    /* splitmix64 on a state of the seed and the chunk index, the same chunk every time */
+    static uint64_t next_random (uint64_t& state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    static float uniform (uint64_t& state, float lo, float hi)
+    {
+        return lo + (hi - lo)*(float)((next_random(state) >> 40)*(1.0/(1 << 24)));
+    }
+
+    void build (WorldChunk& chunk, int index)
+    {
+        const WorldLayout& l = layout_;
+        uint64_t state = l.seed ^ ((uint64_t)index*0xD1B54A32D192ED03ULL);
+        chunk.index = index;
+        chunk.x0 = l.origin_x + index*l.chunk_width;
+        chunk.x1 = chunk.x0 + l.chunk_width;
+        chunk.min_x = chunk.x0;
+        chunk.max_x = chunk.x1;
+        chunk.min_y = l.min_y;
+        chunk.max_y = l.max_y;
+        chunk.vertices = 0;
+
+        chunk.coin_x.resize(l.coins);
+        chunk.coin_y.resize(l.coins);
+        for(int c=0;c<l.coins;c++)
+        {
+            chunk.coin_x[c] = uniform(state, chunk.x0, chunk.x1);
+            chunk.coin_y[c] = uniform(state, l.min_y, l.max_y);
+        }
+        uint64_t all = l.coins == 64 ? ~(uint64_t)0 : ((uint64_t)1 << l.coins) - 1;
+        chunk.alive = all & ~collected_[index];
+
+        for(int b=0;b<l.blocks;b++)
+        {
+            float x = uniform(state, chunk.x0, chunk.x1 - l.block_w);
+            float y = uniform(state, l.min_y, l.max_y);
+            float angle = uniform(state, 0, M_PI);
+            add_box(chunk, WORLD_BLOCK, x, y, angle, 0, 0, l.block_w, l.block_h);
+        }
+        float ground_x0 = std::max(chunk.x0, l.ground_from);
+        if(ground_x0 < chunk.x1)
+            add_box(chunk, WORLD_GROUND, 0, 0, 0, ground_x0, l.ground_bottom, chunk.x1, l.ground_top);
+    }
+
+    /* A collider placed like obstacle_place does and its two triangles */
+    void add_box (WorldChunk& chunk, WorldBoxKind kind, float pivot_x, float pivot_y, float angle,
+                  float x0, float y0, float x1, float y1)
+    {
+        const WorldSurface& surface = layout_.surfaces[kind];
+        int o = obstacle_add(chunk.colliders, OBSTACLE_SOLID, surface.ex, surface.ey);
+        obstacle_place(chunk.colliders, o, pivot_x, pivot_y, angle, x0, y0, x1, y1, 0, 0, 0);
+
+        const float corners[6][2] = { {x0,y0}, {x0,y1}, {x1,y0}, {x1,y0}, {x1,y1}, {x0,y1} };
+        float c = cosf(angle), s = sinf(angle);
+        for(int v=0;v<6;v++)
+        {
+            float x = pivot_x + c*corners[v][0] - s*corners[v][1];
+            float y = pivot_y + s*corners[v][0] + c*corners[v][1];
+            chunk.positions.push_back(x);
+            chunk.positions.push_back(y);
+            chunk.positions.push_back(0);
+            chunk.colors.insert(chunk.colors.end(), surface.rgb, surface.rgb + 3);
+            chunk.min_x = std::min(chunk.min_x, x);
+            chunk.max_x = std::max(chunk.max_x, x);
+            chunk.min_y = std::min(chunk.min_y, y);
+            chunk.max_y = std::max(chunk.max_y, y);
+        }
+        chunk.vertices += 6;
+    }
+
+    WorldLayout layout_;
+    size_t budget_;
+    size_t bytes_;
+    size_t peak_bytes_;
+    size_t estimate_;                   // size of the biggest chunk so far, what the next one may take
+    long loads_, evictions_;
+    long budget_evictions_;             // dropped while still in reach to stay inside the budget
+    long over_budget_;                  // calls that ended over budget, the focus alone did not fit
+    long collected_count_;
+    std::vector<uint64_t> collected_;   // a bit per collected coin, per chunk
+    std::vector<WorldChunk*> resident_;
+    std::function<void(WorldChunk&)> on_load_, on_evict_;
+};
+
+#endif